@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "bimap.hpp"
+
+/**
+ * The original unordered_map-based qubit bimap, kept here as the baseline to
+ * compare QubitBiMap against.
+ */
+class HashQubitBiMap {
+private:
+  std::unordered_map<size_t, size_t> forward;
+  std::unordered_map<size_t, size_t> reverse;
+
+public:
+
+  ssize_t forward_lookup(size_t upstream) {
+    auto iter = forward.find(upstream);
+    if (iter != forward.end()) {
+      return iter->second;
+    }
+    return -1;
+  }
+
+  ssize_t reverse_lookup(size_t downstream) {
+    auto iter = reverse.find(downstream);
+    if (iter != reverse.end()) {
+      return iter->second;
+    }
+    return -1;
+  }
+
+  void unmap_upstream(size_t upstream) {
+    auto iter = forward.find(upstream);
+    if (iter != forward.end()) {
+      reverse.erase(iter->second);
+      forward.erase(iter);
+    }
+  }
+
+  void unmap_downstream(size_t downstream) {
+    auto iter = reverse.find(downstream);
+    if (iter != reverse.end()) {
+      forward.erase(iter->second);
+      reverse.erase(iter);
+    }
+  }
+
+  void map(size_t upstream, size_t downstream) {
+    unmap_upstream(upstream);
+    unmap_downstream(downstream);
+    forward.emplace(std::make_pair(upstream, downstream));
+    reverse.emplace(std::make_pair(downstream, upstream));
+  }
+
+  void clear() {
+    forward.clear();
+    reverse.clear();
+  }
+
+};
+
+/**
+ * Runs the benchmark for the given bimap type, mimicking the access pattern
+ * of the operator: every gate looks up its operands through two maps, and
+ * every flush rebuilds the second map from the mapping result, like
+ * run_mapper() does.
+ */
+template <class T>
+static void run(const char *name, size_t num_qubits, size_t num_gates, size_t flush_interval) {
+  std::mt19937_64 rng(42);
+  T dqcs2virt;
+  T virt2phys;
+  for (size_t qubit = 0; qubit < num_qubits; qubit++) {
+    dqcs2virt.map(qubit + 1, qubit);
+    virt2phys.map(qubit, qubit);
+  }
+
+  // Precompute the workload so random number generation isn't measured.
+  std::vector<size_t> operands(num_gates * 2);
+  for (size_t &operand : operands) {
+    operand = rng() % num_qubits + 1;
+  }
+  std::vector<size_t> permutation(num_qubits);
+  for (size_t qubit = 0; qubit < num_qubits; qubit++) {
+    permutation[qubit] = qubit;
+  }
+
+  size_t checksum = 0;
+  size_t flushes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t gate = 0; gate < num_gates; gate++) {
+    for (size_t i = 0; i < 2; i++) {
+      ssize_t virt = dqcs2virt.forward_lookup(operands[gate * 2 + i]);
+      checksum += virt2phys.forward_lookup(virt);
+    }
+    if ((gate + 1) % flush_interval == 0) {
+      std::swap(permutation[gate % num_qubits], permutation[(gate * 7) % num_qubits]);
+      virt2phys.clear();
+      for (size_t virt = 0; virt < num_qubits; virt++) {
+        virt2phys.map(virt, permutation[virt]);
+      }
+      flushes++;
+    }
+  }
+  double elapsed = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+
+  printf(
+    "%-10s %6zu qubits: %8.2f ns/gate (%zu gates, %zu flushes, checksum %zu)\n",
+    name, num_qubits, elapsed * 1.0e9 / num_gates, num_gates, flushes, checksum);
+}
+
+int main(int argc, char *argv[]) {
+  size_t num_gates = 10000000;
+  size_t flush_interval = 100;
+  if (argc > 1) num_gates = std::strtoul(argv[1], nullptr, 10);
+  if (argc > 2) flush_interval = std::strtoul(argv[2], nullptr, 10);
+  for (size_t num_qubits : {7, 50, 200, 1000}) {
+    run<HashQubitBiMap>("unordered", num_qubits, num_gates, flush_interval);
+    run<QubitBiMap>("dense", num_qubits, num_gates, flush_interval);
+  }
+  return 0;
+}
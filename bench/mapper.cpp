@@ -0,0 +1,554 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <dqcsim>
+#include "plugin.hpp"
+
+// Alias the dqcsim::wrap namespace to something shorter.
+namespace dqcs = dqcsim::wrap;
+
+// Number of heap allocations made through operator new so far.
+static std::atomic<size_t> num_allocations(0);
+
+void *operator new(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void *ptr = std::malloc(size ? size : 1);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+/**
+ * Downstream stub that just counts the gates it receives, and returns zero
+ * for all measurements.
+ */
+class StubDownstream : public Downstream {
+public:
+  size_t num_qubits = 0;
+  size_t num_gates = 0;
+
+  // Measurement results produced but not yet passed through the operator's
+  // modify_measurement().
+  std::vector<dqcs::Measurement> results;
+
+  void allocate(size_t num_qubits) override {
+    this->num_qubits += num_qubits;
+  }
+
+  void gate(dqcs::Gate &&gate) override {
+    num_gates++;
+    if (gate.has_measures()) {
+      dqcs::QubitSet measures = gate.get_measures();
+      while (measures.size()) {
+        results.emplace_back(measures.pop(), dqcs::MeasurementValue::Zero);
+      }
+    }
+  }
+
+  dqcs::Measurement get_measurement(const dqcs::QubitRef &qubit) override {
+    return dqcs::Measurement(qubit, dqcs::MeasurementValue::Zero);
+  }
+
+  dqcs::ArbData arb(dqcs::ArbCmd &&cmd) override {
+    return dqcs::ArbData();
+  }
+
+  uint64_t random() override {
+    return rng();
+  }
+
+  // Random number generator standing in for DQCsim's.
+  std::mt19937_64 rng;
+
+};
+
+/**
+ * Benchmark configuration, taken from the command line.
+ */
+class BenchConfig {
+public:
+  MapperConfig mapper;
+  std::string workload = "random";
+  size_t qubits = 0;
+  size_t gates = 10000;
+  size_t flush = 100;
+  size_t reps = 10;
+  unsigned long seed = 0;
+  std::string h = "h";
+  std::string cx = "cnot";
+  std::string rz = "rz";
+  std::string measure = "measure";
+  bool json = false;
+};
+
+/**
+ * A gate in a synthetic gate stream, using upstream qubit indices.
+ */
+class BenchGate {
+public:
+  std::string name;
+  std::vector<size_t> qubits;
+  double angle;
+  bool measure;
+};
+
+/**
+ * Generates a stream of random single-qubit gates and CNOTs, with a
+ * measurement of a random qubit every `flush` gates.
+ */
+static std::vector<BenchGate> random_circuit(
+  const BenchConfig &config,
+  size_t num_gates,
+  std::mt19937_64 &rng
+) {
+  std::vector<BenchGate> stream;
+  std::uniform_int_distribution<size_t> qubit(1, config.qubits);
+  for (size_t i = 0; i < num_gates; i++) {
+    if (config.flush && i % config.flush == config.flush - 1) {
+      stream.push_back({config.measure, {qubit(rng)}, 0.0, true});
+    } else if (config.qubits > 1 && rng() % 2) {
+      size_t a = qubit(rng);
+      size_t b;
+      do {
+        b = qubit(rng);
+      } while (b == a);
+      stream.push_back({config.cx, {a, b}, 0.0, false});
+    } else if (rng() % 2) {
+      stream.push_back({config.h, {qubit(rng)}, 0.0, false});
+    } else {
+      // Use a limited set of angles, like most real circuits do.
+      double angle = M_PI / 8.0 * (double)(rng() % 16);
+      stream.push_back({config.rz, {qubit(rng)}, angle, false});
+    }
+  }
+  return stream;
+}
+
+/**
+ * Generates a quantum Fourier transform over all qubits, followed by a
+ * measurement of each qubit, repeated `reps` times. Controlled phase gates are
+ * decomposed into CNOTs and RZ gates.
+ */
+static std::vector<BenchGate> qft(const BenchConfig &config) {
+  std::vector<BenchGate> stream;
+  for (size_t rep = 0; rep < config.reps; rep++) {
+    for (size_t i = 1; i <= config.qubits; i++) {
+      stream.push_back({config.h, {i}, 0.0, false});
+      for (size_t j = i + 1; j <= config.qubits; j++) {
+        double theta = M_PI / std::pow(2.0, (double)(j - i));
+        stream.push_back({config.rz, {j}, theta / 2, false});
+        stream.push_back({config.cx, {i, j}, 0.0, false});
+        stream.push_back({config.rz, {j}, -theta / 2, false});
+        stream.push_back({config.cx, {i, j}, 0.0, false});
+        stream.push_back({config.rz, {i}, theta / 2, false});
+      }
+    }
+    for (size_t i = 1; i <= config.qubits; i++) {
+      stream.push_back({config.measure, {i}, 0.0, true});
+    }
+  }
+  return stream;
+}
+
+/**
+ * Generates a random loop body of `flush` gates ending in a measurement, and
+ * repeats it `reps` times, like a variational or error-correction loop would.
+ */
+static std::vector<BenchGate> loop(const BenchConfig &config, std::mt19937_64 &rng) {
+  BenchConfig body_config = config;
+  body_config.flush = 0;
+  std::vector<BenchGate> body = random_circuit(
+    body_config, config.flush ? config.flush - 1 : 0, rng);
+  body.push_back({config.measure, {1}, 0.0, true});
+  std::vector<BenchGate> stream;
+  for (size_t rep = 0; rep < config.reps; rep++) {
+    stream.insert(stream.end(), body.begin(), body.end());
+  }
+  return stream;
+}
+
+/**
+ * Generates `reps` layers of CNOTs between random disjoint pairs of qubits,
+ * each followed by a measurement of a random qubit, so each layer is mapped
+ * as a kernel of its own.
+ */
+static std::vector<BenchGate> layers(const BenchConfig &config, std::mt19937_64 &rng) {
+  std::vector<BenchGate> stream;
+  std::vector<size_t> order;
+  for (size_t i = 1; i <= config.qubits; i++) {
+    order.push_back(i);
+  }
+  std::uniform_int_distribution<size_t> qubit(1, config.qubits);
+  for (size_t rep = 0; rep < config.reps; rep++) {
+    std::shuffle(order.begin(), order.end(), rng);
+    for (size_t i = 0; i + 1 < order.size(); i += 2) {
+      stream.push_back({config.cx, {order[i], order[i + 1]}, 0.0, false});
+    }
+    stream.push_back({config.measure, {qubit(rng)}, 0.0, true});
+  }
+  return stream;
+}
+
+/**
+ * Generates `reps` syndrome extraction cycles of a surface code. The qubits
+ * are laid out row by row on a square grid, on which the qubits in a
+ * checkerboard pattern are the ancillas, alternating between X and Z checks
+ * by row. Each ancilla is entangled with its neighbouring data qubits and
+ * measured at the end of the cycle. Note that the grid is in terms of
+ * upstream qubits, so it is up to the mapper to place it on the platform.
+ */
+static std::vector<BenchGate> surface(const BenchConfig &config) {
+  size_t width = 1;
+  while (width * width < config.qubits) {
+    width++;
+  }
+  std::vector<BenchGate> stream;
+  for (size_t rep = 0; rep < config.reps; rep++) {
+    std::vector<size_t> ancillas;
+    for (size_t index = 0; index < config.qubits; index++) {
+      size_t row = index / width;
+      size_t col = index % width;
+      if ((row + col) % 2 == 0) {
+        continue;
+      }
+      size_t ancilla = index + 1;
+      ancillas.push_back(ancilla);
+      std::vector<size_t> data;
+      if (row > 0) {
+        data.push_back(index - width + 1);
+      }
+      if (col > 0) {
+        data.push_back(index);
+      }
+      if (col + 1 < width && index + 1 < config.qubits) {
+        data.push_back(index + 2);
+      }
+      if (index + width < config.qubits) {
+        data.push_back(index + width + 1);
+      }
+      bool x_check = row % 2 == 0;
+      if (x_check) {
+        stream.push_back({config.h, {ancilla}, 0.0, false});
+      }
+      for (size_t qubit : data) {
+        if (x_check) {
+          stream.push_back({config.cx, {ancilla, qubit}, 0.0, false});
+        } else {
+          stream.push_back({config.cx, {qubit, ancilla}, 0.0, false});
+        }
+      }
+      if (x_check) {
+        stream.push_back({config.h, {ancilla}, 0.0, false});
+      }
+    }
+    for (size_t ancilla : ancillas) {
+      stream.push_back({config.measure, {ancilla}, 0.0, true});
+    }
+  }
+  return stream;
+}
+
+/**
+ * Returns the given percentile of the given samples.
+ */
+static double percentile(std::vector<double> samples, double p) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  std::sort(samples.begin(), samples.end());
+  size_t index = (size_t)std::ceil(p / 100.0 * samples.size());
+  if (index > 0) {
+    index--;
+  }
+  return samples[std::min(index, samples.size() - 1)];
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s <hardware_config.json> <gatemap.json> [options]\n"
+    "\n"
+    "Feeds a synthetic gate stream through the mapper operator logic without\n"
+    "a DQCsim simulation, against a downstream stub.\n"
+    "\n"
+    "Options:\n"
+    "  --workload random|qft|loop|layers|surface\n"
+    "                              gate stream to generate (default random)\n"
+    "  --qubits N                  number of upstream qubits (default: all)\n"
+    "  --gates N                   number of gates for random (default 10000)\n"
+    "  --flush N                   gates per measurement for random/loop\n"
+    "                              (default 100)\n"
+    "  --reps N                    repetitions for qft/loop, number of layers\n"
+    "                              for layers, or cycles for surface\n"
+    "                              (default 10)\n"
+    "  --seed N                    random seed (default 0)\n"
+    "  --h/--cx/--rz/--measure NAME\n"
+    "                              OpenQL gate names to use (defaults h, cnot,\n"
+    "                              rz, measure)\n"
+    "  --option KEY=VALUE          sets an OpenQL option\n"
+    "  --kernel-cache N            kernel cache capacity\n"
+    "  --detect-cache N            detection cache capacity\n"
+    "  --fast-path yes|no          whether to enable the fast path\n"
+    "  --peephole yes|no           whether to enable the peephole optimizer\n"
+    "  --swap-cancellation yes|no  whether to enable swap cancellation\n"
+    "  --virtual-swaps yes|no      whether to permute qubits instead of swapping\n"
+    "  --coalesce yes|no           whether to coalesce measurements and preps\n"
+    "  --window-gates N            flush window in gates\n"
+    "  --window-depth N            flush window in circuit depth\n"
+    "  --defer yes|no              whether to defer measurements\n"
+    "  --causal-flush yes|no       whether measurements only flush their cone\n"
+    "  --trial K=V,...             also map with these options overridden\n"
+    "  --trial-metric swaps|depth  metric for picking the best trial\n"
+    "  --placement-effort N        initial placement exchange evaluations\n"
+    "  --placement-budget MS       initial placement time limit\n"
+    "  --route-cache DIR           cache routing tables in DIR\n"
+    "  --snapshot FILE             use a precompiled snapshot for the gatemap\n"
+    "  --record FILE               record the mapping results to FILE\n"
+    "  --replay FILE               replay the mapping results from FILE\n"
+    "  --timeline FILE             write a Chrome trace event timeline to FILE\n"
+    "  --json                      print results as JSON\n",
+    argv0);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+  if (argc < 3) {
+    usage(argv[0]);
+  }
+  config.mapper.platform_json_fname = argv[1];
+  config.mapper.gatemap_json_fname = argv[2];
+  for (int i = 3; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--json") {
+      config.json = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+    }
+    std::string value = argv[++i];
+    if (arg == "--workload") {
+      config.workload = value;
+    } else if (arg == "--qubits") {
+      config.qubits = std::stoul(value);
+    } else if (arg == "--gates") {
+      config.gates = std::stoul(value);
+    } else if (arg == "--flush") {
+      config.flush = std::stoul(value);
+    } else if (arg == "--reps") {
+      config.reps = std::stoul(value);
+    } else if (arg == "--seed") {
+      config.seed = std::stoul(value);
+    } else if (arg == "--h") {
+      config.h = value;
+    } else if (arg == "--cx") {
+      config.cx = value;
+    } else if (arg == "--rz") {
+      config.rz = value;
+    } else if (arg == "--measure") {
+      config.measure = value;
+    } else if (arg == "--option") {
+      size_t eq = value.find('=');
+      if (eq == std::string::npos) {
+        usage(argv[0]);
+      }
+      config.mapper.options.emplace_back(value.substr(0, eq), value.substr(eq + 1));
+    } else if (arg == "--kernel-cache") {
+      config.mapper.kernel_cache_capacity = std::stoul(value);
+    } else if (arg == "--detect-cache") {
+      config.mapper.detect_cache_capacity = std::stoul(value);
+    } else if (arg == "--fast-path") {
+      config.mapper.fast_path = value == "yes";
+    } else if (arg == "--peephole") {
+      config.mapper.peephole = value == "yes";
+    } else if (arg == "--swap-cancellation") {
+      config.mapper.swap_cancellation = value == "yes";
+    } else if (arg == "--virtual-swaps") {
+      config.mapper.virtual_swaps = value == "yes";
+    } else if (arg == "--coalesce") {
+      config.mapper.coalesce = value == "yes";
+    } else if (arg == "--window-gates") {
+      config.mapper.window_gates = std::stoul(value);
+    } else if (arg == "--window-depth") {
+      config.mapper.window_depth = std::stoul(value);
+    } else if (arg == "--defer") {
+      config.mapper.defer_measurements = value == "yes";
+    } else if (arg == "--causal-flush") {
+      config.mapper.causal_flush = value == "yes";
+    } else if (arg == "--trial") {
+      std::vector<std::pair<std::string, std::string>> trial;
+      size_t start = 0;
+      while (start < value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) {
+          end = value.size();
+        }
+        std::string option = value.substr(start, end - start);
+        size_t eq = option.find('=');
+        if (eq == std::string::npos) {
+          usage(argv[0]);
+        }
+        trial.emplace_back(option.substr(0, eq), option.substr(eq + 1));
+        start = end + 1;
+      }
+      config.mapper.trials.push_back(std::move(trial));
+    } else if (arg == "--trial-metric") {
+      if (value == "swaps") {
+        config.mapper.trial_metric = TrialMetric::Swaps;
+      } else if (value == "depth") {
+        config.mapper.trial_metric = TrialMetric::Depth;
+      } else {
+        usage(argv[0]);
+      }
+    } else if (arg == "--snapshot") {
+      config.mapper.snapshot_fname = value;
+    } else if (arg == "--route-cache") {
+      config.mapper.route_cache_dir = value;
+    } else if (arg == "--placement-effort") {
+      config.mapper.placement_effort = std::stoul(value);
+    } else if (arg == "--placement-budget") {
+      config.mapper.placement_budget = std::stoul(value);
+    } else if (arg == "--record") {
+      config.mapper.record_fname = value;
+    } else if (arg == "--replay") {
+      config.mapper.replay_fname = value;
+    } else if (arg == "--timeline") {
+      config.mapper.timeline_fname = value;
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  // Initialize the operator.
+  StubDownstream downstream;
+  downstream.rng.seed(config.seed);
+  MapperPlugin plugin;
+  auto init_start = std::chrono::steady_clock::now();
+  plugin.initialize(downstream, config.mapper);
+  double init_time = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - init_start).count();
+  if (!config.qubits || config.qubits > plugin.num_qubits) {
+    config.qubits = plugin.num_qubits;
+  }
+
+  // Generate the gate stream, and convert it to DQCsim gates up front, so
+  // this isn't part of the measurement.
+  std::mt19937_64 rng(config.seed);
+  std::vector<BenchGate> stream;
+  if (config.workload == "random") {
+    stream = random_circuit(config, config.gates, rng);
+  } else if (config.workload == "qft") {
+    stream = qft(config);
+  } else if (config.workload == "loop") {
+    stream = loop(config, rng);
+  } else if (config.workload == "layers") {
+    stream = layers(config, rng);
+  } else if (config.workload == "surface") {
+    stream = surface(config);
+  } else {
+    usage(argv[0]);
+  }
+  std::vector<dqcs::Gate> gates;
+  gates.reserve(stream.size());
+  for (const BenchGate &gate : stream) {
+    OpenQLGateDescription desc;
+    desc.id = plugin.gatemap->get_id(gate.name);
+    desc.qubits = gate.qubits;
+    desc.angle = gate.angle;
+    desc.multi_qubit_parallel = gate.measure;
+    gates.push_back(plugin.gatemap->construct(desc));
+  }
+
+  // Allocate the upstream qubits.
+  dqcs::QubitSet qubits;
+  for (size_t qubit = 1; qubit <= config.qubits; qubit++) {
+    qubits.push(dqcs::QubitRef(qubit));
+  }
+  plugin.allocate(downstream, std::move(qubits));
+
+  // Run the gate stream, measuring the latency of each measurement, as this
+  // is when the kernel is flushed.
+  std::vector<double> flush_latencies;
+  size_t allocations_start = num_allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < gates.size(); i++) {
+    if (stream[i].measure) {
+      auto flush_start = std::chrono::steady_clock::now();
+      plugin.gate(downstream, std::move(gates[i]));
+      flush_latencies.push_back(std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - flush_start).count());
+    } else {
+      plugin.gate(downstream, std::move(gates[i]));
+    }
+
+    // Pass the measurement results back through the operator, like DQCsim
+    // would.
+    for (dqcs::Measurement &result : downstream.results) {
+      plugin.modify_measurement(std::move(result));
+    }
+    downstream.results.clear();
+  }
+  auto drop_start = std::chrono::steady_clock::now();
+  plugin.drop(downstream);
+  auto end = std::chrono::steady_clock::now();
+  flush_latencies.push_back(std::chrono::duration<double>(end - drop_start).count());
+  double total_time = std::chrono::duration<double>(end - start).count();
+  size_t allocations = num_allocations.load() - allocations_start;
+
+  // Determine peak memory usage.
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  size_t peak_rss_kib = usage.ru_maxrss;
+
+  // Report the results.
+  double gates_per_sec = gates.size() / total_time;
+  double allocations_per_gate = (double)allocations / gates.size();
+  double p50 = percentile(flush_latencies, 50.0);
+  double p99 = percentile(flush_latencies, 99.0);
+  if (config.json) {
+    nlohmann::json json = {
+      {"workload", config.workload},
+      {"qubits", config.qubits},
+      {"platform_qubits", plugin.num_qubits},
+      {"gates", gates.size()},
+      {"flushes", flush_latencies.size()},
+      {"init_time", init_time},
+      {"total_time", total_time},
+      {"gates_per_sec", gates_per_sec},
+      {"allocations_per_gate", allocations_per_gate},
+      {"flush_latency_p50", p50},
+      {"flush_latency_p99", p99},
+      {"peak_rss_kib", peak_rss_kib},
+      {"stats", plugin.stats_json()}
+    };
+    printf("%s\n", json.dump(2).c_str());
+  } else {
+    printf("workload:          %s\n", config.workload.c_str());
+    printf("qubits:            %zu of %zu\n", config.qubits, plugin.num_qubits);
+    printf("gates in/out:      %zu/%zu\n", gates.size(), downstream.num_gates);
+    printf("flushes:           %zu\n", flush_latencies.size());
+    printf("init time:         %.3f s\n", init_time);
+    printf("total time:        %.3f s\n", total_time);
+    printf("throughput:        %.0f gates/s\n", gates_per_sec);
+    printf("allocations:       %.1f per gate\n", allocations_per_gate);
+    printf("flush latency p50: %.3f ms\n", p50 * 1.0e3);
+    printf("flush latency p99: %.3f ms\n", p99 * 1.0e3);
+    printf("peak RSS:          %zu KiB\n", peak_rss_kib);
+  }
+
+  return 0;
+}
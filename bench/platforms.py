@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""Generator for synthetic OpenQL platform JSON files and matching gatemaps.
+
+Generates square grid and heavy-hex platforms of arbitrary size, for
+benchmarking the operator at sizes beyond those of the real platforms. The
+platforms have a fixed instruction set, covering the gates the benchmarks
+use, and are only meant for mapping: they don't describe any control
+electronics."""
+
+import json
+import math
+import os
+import sys
+
+# Instructions of the synthetic platforms, as (name, duration, matrix) tuples.
+# The gatemap entry for each is derived from the name by platform2gates.
+_R = 0.7071068
+INSTRUCTIONS = [
+    ('prepz', 40, [[1, 0], [0, 0], [0, 0], [1, 0]]),
+    ('i', 20, [[1, 0], [0, 0], [0, 0], [1, 0]]),
+    ('x', 20, [[0, 0], [1, 0], [1, 0], [0, 0]]),
+    ('y', 20, [[0, 0], [0, -1], [0, 1], [0, 0]]),
+    ('z', 20, [[1, 0], [0, 0], [0, 0], [-1, 0]]),
+    ('h', 20, [[_R, 0], [_R, 0], [_R, 0], [-_R, 0]]),
+    ('s', 20, [[1, 0], [0, 0], [0, 0], [0, 1]]),
+    ('sdag', 20, [[1, 0], [0, 0], [0, 0], [0, -1]]),
+    ('t', 20, [[1, 0], [0, 0], [0, 0], [_R, _R]]),
+    ('tdag', 20, [[1, 0], [0, 0], [0, 0], [_R, -_R]]),
+    ('rx', 20, [[1, 0], [0, 0], [0, 0], [1, 0]]),
+    ('ry', 20, [[1, 0], [0, 0], [0, 0], [1, 0]]),
+    ('rz', 20, [[1, 0], [0, 0], [0, 0], [1, 0]]),
+    ('cnot', 40, [[1, 0], [0, 0], [0, 0], [1, 0]]),
+    ('cz', 40, [[1, 0], [0, 0], [0, 0], [1, 0]]),
+    ('swap', 120, [[1, 0], [0, 0], [0, 0], [1, 0]]),
+    ('measure', 300, [[1, 0], [0, 0], [0, 0], [1, 0]]),
+]
+
+def grid(num_qubits):
+    """Returns the coordinates and couplings of the smallest square grid with
+    at least the given number of qubits, with the last row possibly cut short.
+    Each qubit is coupled to its horizontal and vertical neighbors."""
+    width = max(1, math.ceil(math.sqrt(num_qubits)))
+    coords = [(i % width, i // width) for i in range(num_qubits)]
+    couplings = []
+    for i in range(num_qubits):
+        if i % width + 1 < width and i + 1 < num_qubits:
+            couplings.append((i, i + 1))
+        if i + width < num_qubits:
+            couplings.append((i, i + width))
+    return coords, couplings
+
+def heavy_hex(num_qubits):
+    """Returns the coordinates and couplings of the smallest roughly square
+    heavy-hex lattice with at least the given number of qubits, like that of
+    IBM's devices. The lattice consists of rows of linearly coupled qubits,
+    with bridge qubits coupling each pair of adjacent rows at every fourth
+    column, offset by two columns on alternate rows."""
+
+    # Find the smallest lattice with at least the requested number of
+    # qubits, growing the number of rows and the row width in turn.
+    rows, width = 1, 1
+    def size(rows, width):
+        bridges = sum(
+            len(range(0 if row % 2 == 0 else 2, width, 4))
+            for row in range(rows - 1))
+        return rows * width + bridges
+    while size(rows, width) < num_qubits:
+        if width < 4 * rows:
+            width += 1
+        else:
+            rows += 1
+
+    coords = []
+    couplings = []
+    index = {}
+    for row in range(rows):
+        for col in range(width):
+            index[row, col] = len(coords)
+            coords.append((col, 2 * row))
+            if col > 0:
+                couplings.append((index[row, col - 1], index[row, col]))
+    for row in range(rows - 1):
+        for col in range(0 if row % 2 == 0 else 2, width, 4):
+            bridge = len(coords)
+            coords.append((col, 2 * row + 1))
+            couplings.append((index[row, col], bridge))
+            couplings.append((bridge, index[row + 1, col]))
+    return coords, couplings
+
+TOPOLOGIES = {
+    'grid': grid,
+    'heavy-hex': heavy_hex,
+}
+
+def platform(coords, couplings):
+    """Returns an OpenQL platform description for the given qubit coordinates
+    and couplings, as a JSON-serializable dict. Every coupling can be used in
+    both directions."""
+    num_qubits = len(coords)
+    edges = []
+    for src, dst in couplings:
+        edges.append({'id': len(edges), 'src': src, 'dst': dst})
+        edges.append({'id': len(edges), 'src': dst, 'dst': src})
+    instructions = {}
+    for name, duration, matrix in INSTRUCTIONS:
+        instructions[name] = {
+            'duration': duration,
+            'matrix': [[float(re), float(im)] for re, im in matrix],
+            'disable_optimization': True,
+        }
+    return {
+        'eqasm_compiler': 'qx',
+        'hardware_settings': {
+            'qubit_number': num_qubits,
+            'cycle_time': 20,
+        },
+        'resources': {
+            'qubits': {
+                'count': num_qubits,
+            },
+        },
+        'topology': {
+            'x_size': max(x for x, _ in coords) + 1,
+            'y_size': max(y for _, y in coords) + 1,
+            'qubits': [
+                {'id': i, 'x': x, 'y': y}
+                for i, (x, y) in enumerate(coords)
+            ],
+            'edges': edges,
+        },
+        'instructions': instructions,
+        'gate_decomposition': {},
+    }
+
+def generate(topology, num_qubits, directory):
+    """Writes a platform with the given topology and at least the given number
+    of qubits to the given directory, along with a gatemap for it. Returns the
+    filenames of the platform and the gatemap, and the actual number of
+    qubits."""
+    sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'python'))
+    import dqcsim_openql_mapper
+
+    coords, couplings = TOPOLOGIES[topology](num_qubits)
+    basename = os.path.join(directory, '{}-{}'.format(topology, num_qubits))
+    plat_fname = basename + '.json'
+    gate_fname = basename + '-gates.json'
+    with open(plat_fname, 'w') as f:
+        json.dump(platform(coords, couplings), f, indent=2)
+    dqcsim_openql_mapper.platform2gates(plat_fname, gate_fname)
+    return plat_fname, gate_fname, len(coords)
+
+if __name__ == '__main__':
+    if len(sys.argv) != 4 or sys.argv[1] not in TOPOLOGIES:
+        print('Usage: platforms.py <{}> <num_qubits> <output_dir>'.format(
+            '|'.join(TOPOLOGIES)))
+        print()
+        print(__doc__)
+        sys.exit(1)
+    plat_fname, gate_fname, num_qubits = generate(
+        sys.argv[1], int(sys.argv[2]), sys.argv[3])
+    print('Wrote {} ({} qubits) and {}'.format(plat_fname, num_qubits, gate_fname))
@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+"""Scaling benchmark suite for the operator.
+
+Runs standard workloads through bench-mapper on synthetic grid and heavy-hex
+platforms of increasing size, and writes the results as CSV. Optionally
+compares the results against those of an earlier run, failing if any of them
+got worse by more than a tolerance.
+
+The workloads are:
+
+ - layers: layers of CNOTs between random disjoint pairs of qubits, each
+   mapped as a kernel of its own;
+ - qft: a single quantum Fourier transform over all qubits;
+ - surface: syndrome extraction cycles of a surface code."""
+
+import argparse
+import csv
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(__file__))
+import platforms
+
+# Columns of the output CSV file. The first three identify the run, and the
+# next two record the initial placement settings, which must match those of
+# the baseline for the results to be comparable.
+COLUMNS = [
+    'topology',
+    'size',
+    'workload',
+    'placement_effort',
+    'placement_budget',
+    'platform_qubits',
+    'gates_in',
+    'gates_out',
+    'kernels',
+    'wall_time',
+    'kernel_time',
+    'flush_latency_p50',
+    'flush_latency_p99',
+    'mapper_time',
+    'swaps_inserted',
+    'peak_rss_kib',
+]
+
+# Columns checked against the baseline, with the minimum baseline value for
+# which they are checked, as timings of short runs are mostly noise.
+CHECKED = {
+    'wall_time': 0.05,
+    'mapper_time': 0.05,
+    'swaps_inserted': 0,
+    'peak_rss_kib': 0,
+}
+
+def run(args, topology, size, workload, plat_fname, gate_fname):
+    """Runs bench-mapper for a single configuration, returning a row for the
+    output CSV file, or None if it failed or timed out."""
+    cmd = [
+        args.bench, plat_fname, gate_fname,
+        '--workload', workload,
+        '--qubits', str(size),
+        '--reps', '1' if workload == 'qft' else str(args.reps),
+        '--seed', str(args.seed),
+        '--placement-effort', str(args.placement_effort),
+        '--placement-budget', '0',
+        '--json',
+    ]
+    for option in args.option:
+        cmd += ['--option', option]
+    try:
+        result = subprocess.run(
+            cmd, stdout=subprocess.PIPE, check=True, timeout=args.timeout)
+    except subprocess.TimeoutExpired:
+        print('  timed out after {} s'.format(args.timeout))
+        return None
+    except subprocess.CalledProcessError as e:
+        print('  failed with exit code {}'.format(e.returncode))
+        return None
+    data = json.loads(result.stdout.decode('utf-8'))
+    stats = data['stats']
+    return {
+        'topology': topology,
+        'size': size,
+        'workload': workload,
+        'placement_effort': args.placement_effort,
+        'placement_budget': 0,
+        'platform_qubits': data['platform_qubits'],
+        'gates_in': stats['gates_in'],
+        'gates_out': stats['gates_out'],
+        'kernels': data['flushes'],
+        'wall_time': data['total_time'],
+        'kernel_time': data['total_time'] / max(1, data['flushes']),
+        'flush_latency_p50': data['flush_latency_p50'],
+        'flush_latency_p99': data['flush_latency_p99'],
+        'mapper_time': stats['time']['map'],
+        'swaps_inserted': stats['swaps_inserted'],
+        'peak_rss_kib': data['peak_rss_kib'],
+    }
+
+def check(rows, baseline_fname, tolerance):
+    """Compares the given rows against those in the given baseline CSV file.
+    Returns the list of regressions found, as human-readable strings."""
+    with open(baseline_fname, 'r') as f:
+        baseline = {
+            (row['topology'], row['size'], row['workload']): row
+            for row in csv.DictReader(f)
+        }
+    regressions = []
+    for row in rows:
+        key = (row['topology'], str(row['size']), row['workload'])
+        if key not in baseline:
+            continue
+        if any(
+            str(row[column]) != baseline[key].get(column)
+            for column in ('placement_effort', 'placement_budget')
+        ):
+            regressions.append(
+                '{} {} {}: baseline used different placement settings'.format(*key))
+            continue
+        for column, floor in CHECKED.items():
+            old = float(baseline[key][column])
+            new = float(row[column])
+            if old < floor:
+                continue
+            if new > old * (1.0 + tolerance) + (1 if column == 'swaps_inserted' else 0):
+                regressions.append('{} {} {}: {} went from {:g} to {:g}'.format(
+                    *key, column, old, new))
+    return regressions
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument(
+        '--bench', default='bench-mapper',
+        help='path to the bench-mapper executable (default: from PATH)')
+    parser.add_argument(
+        '--topologies', default=','.join(platforms.TOPOLOGIES),
+        help='comma-separated platform topologies (default: all)')
+    parser.add_argument(
+        '--sizes', default='50,200,1000',
+        help='comma-separated numbers of qubits (default: 50,200,1000)')
+    parser.add_argument(
+        '--workloads', default='layers,qft,surface',
+        help='comma-separated workloads (default: all)')
+    parser.add_argument(
+        '--reps', type=int, default=10,
+        help='number of layers or surface code cycles (default: 10)')
+    parser.add_argument(
+        '--seed', type=int, default=0,
+        help='random seed (default: 0)')
+    parser.add_argument(
+        '--placement-effort', type=int, default=1000000,
+        help='qubit exchanges evaluated for the initial placement; the '
+        'placement time limit is always disabled, so the results don\'t '
+        'depend on timing (default: 1000000)')
+    parser.add_argument(
+        '--option', action='append', default=None, metavar='KEY=VALUE',
+        help='OpenQL option to pass to bench-mapper, may be repeated '
+        '(default: mapper=base)')
+    parser.add_argument(
+        '--timeout', type=float, default=None,
+        help='time limit for each run in seconds, after which it counts as '
+        'failed')
+    parser.add_argument(
+        '--output', default='scaling.csv',
+        help='output CSV file (default: scaling.csv)')
+    parser.add_argument(
+        '--baseline',
+        help='CSV file from an earlier run to check for regressions against')
+    parser.add_argument(
+        '--tolerance', type=float, default=0.2,
+        help='relative amount by which a result may be worse than the '
+        'baseline (default: 0.2)')
+    args = parser.parse_args()
+    if args.option is None:
+        args.option = ['mapper=base']
+
+    rows = []
+    failures = []
+    with tempfile.TemporaryDirectory() as tmpdir:
+        for topology in args.topologies.split(','):
+            for size in map(int, args.sizes.split(',')):
+                plat_fname, gate_fname, _ = platforms.generate(topology, size, tmpdir)
+                for workload in args.workloads.split(','):
+                    print('{} {} {}...'.format(topology, size, workload))
+                    start = time.time()
+                    row = run(args, topology, size, workload, plat_fname, gate_fname)
+                    if row is None:
+                        failures.append('{} {} {}: run failed'.format(
+                            topology, size, workload))
+                        continue
+                    print('  {:.3f} s, {} swaps'.format(
+                        time.time() - start, row['swaps_inserted']))
+                    rows.append(row)
+
+    with open(args.output, 'w', newline='') as f:
+        writer = csv.DictWriter(f, fieldnames=COLUMNS)
+        writer.writeheader()
+        writer.writerows(rows)
+    print('Wrote {}'.format(args.output))
+
+    if args.baseline:
+        failures += check(rows, args.baseline, args.tolerance)
+    if failures:
+        print()
+        print('The following checks failed:')
+        print()
+        for failure in failures:
+            print(' - {}'.format(failure))
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
@@ -3,6 +3,10 @@ import dqcsim_openql_mapper
 from dqcsim.plugin import *
 from dqcsim.host import *
 import tempfile
+import json
+import math
+import struct
+import subprocess
 import os
 
 TEST_HARDWARE_CFG = """
@@ -419,39 +423,448 @@ class DeutschJozsa(Frontend):
         self.free(qi, qo)
 
 
+@plugin("Repeated Deutsch-Jozsa", "Tutorial", "0.1")
+class RepeatedDeutschJozsa(DeutschJozsa):
+    """Same as DeutschJozsa, but runs the same oracle a couple of times, such
+    that the mapper sees the same kernels over and over."""
+
+    def handle_run(self):
+        qi, qo = self.allocate(2)
+
+        for _ in range(4):
+            self.info('Running Deutsch-Jozsa on x -> x...')
+            self.deutsch_jozsa(qi, qo, self.oracle_passthrough, 'balanced')
+
+        self.free(qi, qo)
+
+
+@plugin("Deutsch-Jozsa with deferred measurements", "Tutorial", "0.1")
+class DeferredDeutschJozsa(DeutschJozsa):
+    """Same as DeutschJozsa, but explicitly synchronizes with the mapper after
+    each measurement, such that it works when measurements are deferred."""
+
+    def measure(self, *args, **kwargs):
+        super().measure(*args, **kwargs)
+        self.arb('openql_mapper', 'sync')
+
+
+@plugin("Deutsch-Jozsa with redundant gates", "Tutorial", "0.1")
+class RedundantDeutschJozsa(DeutschJozsa):
+    """Same as DeutschJozsa, but sends redundant gates after preparing each
+    qubit, which the peephole optimizer should remove: two X gates that
+    cancel out, and Z rotations that merge into a single rotation and then
+    into a full turn. Z rotations of the freshly prepared qubit only change
+    its global phase anyway, so this doesn't affect the results."""
+
+    def prepare(self, *args, **kwargs):
+        super().prepare(*args, **kwargs)
+        for qubit in args:
+            self.x_gate(qubit)
+            self.x_gate(qubit)
+            self.rz_gate(qubit, 0.5)
+            self.rz_gate(qubit, 0.25)
+            self.rz_gate(qubit, 2.0 * math.pi - 0.75)
+
+
+@plugin("Deutsch-Jozsa with routing", "Tutorial", "0.1")
+class RoutedDeutschJozsa(DeutschJozsa):
+    """Same as DeutschJozsa, but with oracles that use an ancilla qubit, such
+    that the input, output, and ancilla qubits all interact with each other.
+    The topology of the test platform has no triangles, so this always needs
+    routing."""
+
+    def oracle_triangle(self, qi, qo):
+        """x -> 0 oracle function, computing x into the ancilla and back."""
+        self.cnot_gate(qi, self.qa)
+        self.cnot_gate(self.qa, qo)
+        self.cnot_gate(qi, self.qa)
+        self.cnot_gate(qi, qo)
+
+    def oracle_triangle_invert(self, qi, qo):
+        """x -> x oracle function, computing x into the ancilla and back."""
+        self.oracle_triangle(qi, qo)
+        self.cnot_gate(qi, qo)
+
+    def handle_run(self):
+        qi, qo, self.qa = self.allocate(3)
+
+        self.info('Running Deutsch-Jozsa on x -> x ^ x...')
+        self.prepare(self.qa)
+        self.deutsch_jozsa(qi, qo, self.oracle_triangle, 'constant')
+
+        self.info('Running Deutsch-Jozsa on x -> x ^ x ^ x...')
+        self.prepare(self.qa)
+        self.deutsch_jozsa(qi, qo, self.oracle_triangle_invert, 'balanced')
+
+        self.free(qi, qo, self.qa)
+
+
+@plugin("Deutsch-Jozsa with swaps", "Tutorial", "0.1")
+class SwappedDeutschJozsa(DeutschJozsa):
+    """Same as DeutschJozsa, but with an x -> x oracle that swaps the input
+    and output qubits around a cnot in the other direction. On a platform
+    that decomposes swaps into cnots, the swap optimizer should fold this
+    into a single cnot."""
+
+    def oracle_swapped(self, qi, qo):
+        """x -> x oracle function, with the qubits swapped around it."""
+        self.swap_gate(qi, qo)
+        self.cnot_gate(qo, qi)
+        self.swap_gate(qi, qo)
+
+    def handle_run(self):
+        qi, qo = self.allocate(2)
+
+        self.info('Running Deutsch-Jozsa on x -> x with swaps...')
+        self.deutsch_jozsa(qi, qo, self.oracle_swapped, 'balanced')
+
+        self.free(qi, qo)
+
+
+@plugin("Register measurement", "Test", "0.1")
+class RegisterMeasurement(Frontend):
+    """Prepares and measures a register of qubits with a single gate each,
+    flipping one of the qubits in between, and checks the results. The mapper
+    splits the gates up into one per qubit, which coalescing should join back
+    up."""
+
+    def handle_run(self):
+        qubits = self.allocate(3)
+
+        for flipped in qubits:
+            self.info('Measuring the register with one qubit flipped...')
+            self.prepare(*qubits)
+            self.x_gate(flipped)
+            self.measure(*qubits)
+            for qubit in qubits:
+                if bool(self.get_measurement(qubit).value) != (qubit == flipped):
+                    raise ValueError('unexpected measurement result!')
+
+        self.free(*qubits)
+
+
+@plugin("Gate recorder", "Test", "0.1")
+class GateRecorder(Operator):
+    """Passes all gates through unchanged, while recording them, such that the
+    gates the mapper sends downstream can be compared between runs."""
+
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.gates = []
+
+    def handle_unitary_gate(self, targets, matrix, arb):
+        self.gates.append(('unitary', list(targets), [], str(matrix)))
+        self.unitary(targets, matrix, arb=arb)
+
+    def handle_controlled_gate(self, targets, controls, matrix, arb):
+        self.gates.append(('unitary', list(targets), list(controls), str(matrix)))
+        self.unitary(targets, matrix, controls, arb=arb)
+
+    def handle_measurement_gate(self, measures, basis, arb):
+        self.gates.append(('measure', list(measures), [], str(basis)))
+        self.measure(*measures, basis=basis, arb=arb)
+
+    def handle_prepare_gate(self, targets, basis, arb):
+        self.gates.append(('prep', list(targets), [], str(basis)))
+        self.prepare(*targets, basis=basis, arb=arb)
+
+
+def mapper_cmd(oper, *args):
+    """Returns an openql_mapper initialization command with the given string
+    arguments."""
+    return ArbCmd('openql_mapper', oper, *[arg.encode('utf-8') for arg in args])
+
+
+def per_qubit(gates):
+    """Returns the sequence of recorded gates acting on each qubit. Gates on
+    different qubits commute, so this is what must be preserved when the
+    mapper is free to reorder them."""
+    sequences = {}
+    for gate in gates:
+        for qubit in gate[1] + gate[2]:
+            sequences.setdefault(qubit, []).append(gate)
+    return sequences
+
+
 class Constructor(unittest.TestCase):
 
-    def test_simple(self):
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.plat_fname = self.tmpdir.name + os.sep + 'hardware_config.json'
+        self.gate_fname = self.tmpdir.name + os.sep + 'gates.json'
+        self.write_platform(json.loads(TEST_HARDWARE_CFG))
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def write_platform(self, hardware_config):
+        """Writes the given hardware configuration and the gatemap generated
+        from it to the files the mapper is initialized with."""
+        with open(self.plat_fname, 'w') as f:
+            json.dump(hardware_config, f)
+        dqcsim_openql_mapper.platform2gates(self.plat_fname, self.gate_fname)
+
+    def write_decomposing_platform(self):
+        """Writes a variant of the test platform that decomposes swaps into
+        cnots. OpenQL prefers a swap instruction over the decomposition, so
+        those are removed."""
+        hardware_config = json.loads(TEST_HARDWARE_CFG)
+        del hardware_config['instructions']['swap']
+        del hardware_config['instructions']['move']
+        hardware_config['gate_decomposition'] = {
+            'swap %0,%1': ['cnot %0,%1', 'cnot %1,%0', 'cnot %0,%1']
+        }
+        self.write_platform(hardware_config)
+
+    def simulate(self, frontend, *init, env=None):
+        """Runs the given frontend through the mapper and QX, passing the
+        given additional initialization commands and environment variables to
+        the mapper. Returns the stats of the mapper and the gates it sent
+        downstream. The random seed is fixed, so runs that only differ in
+        optimizations that should not affect the result can be compared."""
+        recorder = GateRecorder()
+        with Simulator(
+            (frontend, {
+                'verbosity': Loglevel.INFO
+            }),
+            ('openql-mapper', {
+                'name': 'mapper',
+                'init': [
+                    mapper_cmd('hardware_config', self.plat_fname),
+                    mapper_cmd('gatemap', self.gate_fname),
+                ] + list(init),
+                'env': env or {},
+            }),
+            (recorder, {
+                'verbosity': Loglevel.INFO
+            }),
+            ('qx', {
+                'verbosity': Loglevel.INFO
+            }),
+            stderr_verbosity=Loglevel.INFO,
+            seed=1
+        ) as sim:
+            sim.run()
+            stats = sim.arb('mapper', 'openql_mapper', 'stats')
+        return stats, recorder.gates
 
-        with tempfile.TemporaryDirectory() as tmpdir:
-
-            plat_fname = tmpdir + os.sep + 'hardware_config.json'
-            gate_fname = tmpdir + os.sep + 'gates.json'
-
-            with open(plat_fname, 'w') as f:
-                f.write(TEST_HARDWARE_CFG)
-
-            dqcsim_openql_mapper.platform2gates(plat_fname, gate_fname)
-
-            with Simulator(
-                (DeutschJozsa(), {
-                    'verbosity': Loglevel.INFO
-                }),
-                ('openql-mapper', {
-                    'init': [
-                        ArbCmd(
-                            'openql_mapper', 'hardware_config',
-                            plat_fname.encode('utf-8')
-                        ),
-                        ArbCmd(
-                            'openql_mapper', 'gatemap',
-                            gate_fname.encode('utf-8')
-                        ),
-                    ]
-                }),
-                ('qx', {
-                    'verbosity': Loglevel.INFO
-                }),
-                stderr_verbosity=Loglevel.INFO
-            ) as sim:
-                sim.run()
+    def test_simple(self):
+        self.simulate(DeutschJozsa())
+
+    def test_stats(self):
+        stats, _ = self.simulate(DeutschJozsa())
+        self.assertGreater(stats['gates_in'], 0)
+        self.assertGreater(stats['gates_out'], 0)
+
+    def test_defer_measurements(self):
+        stats, _ = self.simulate(
+            DeferredDeutschJozsa(),
+            mapper_cmd('defer_measurements', 'yes'))
+        self.assertGreater(stats['measurements_deferred'], 0)
+
+    def test_causal_flush(self):
+        stats, _ = self.simulate(
+            DeutschJozsa(),
+            mapper_cmd('causal_flush', 'yes'))
+        self.assertGreater(stats['kernels']['cone_flushes'], 0)
+
+    def test_peephole(self):
+        stats, _ = self.simulate(
+            RedundantDeutschJozsa(),
+            mapper_cmd('peephole', 'yes'))
+        self.assertGreater(stats['peephole']['rotations_merged'], 0)
+        self.assertGreater(stats['peephole']['inverses_cancelled'], 0)
+        self.assertGreater(stats['peephole']['identities_dropped'], 0)
+
+    def test_swap_folding(self):
+        self.write_decomposing_platform()
+
+        # Send the swaps through the mapper, which decomposes them, rather
+        # than around it.
+        _, gates_before = self.simulate(
+            SwappedDeutschJozsa(),
+            mapper_cmd('fast_path', 'no'))
+        stats, gates_after = self.simulate(
+            SwappedDeutschJozsa(),
+            mapper_cmd('fast_path', 'no'),
+            mapper_cmd('swap_cancellation', 'yes'))
+        self.assertTrue(stats['swap_optimizer']['folding'])
+        self.assertGreater(stats['swap_optimizer']['swaps_folded'], 0)
+
+        # The oracle is seven cnots on the same pair in decomposed form, which
+        # fold into a single cnot.
+        removed = stats['swap_optimizer']['gates_removed']
+        self.assertGreaterEqual(removed, 6)
+        self.assertEqual(len(gates_after), len(gates_before) - removed)
+
+    def test_virtual_swaps(self):
+        stats, _ = self.simulate(
+            RoutedDeutschJozsa(),
+            mapper_cmd('virtual_swaps', 'yes'))
+        self.assertGreater(stats['swaps_virtual'], 0)
+
+    def test_replay(self):
+        trace_fname = self.tmpdir.name + os.sep + 'trace.bin'
+
+        # Record a run, with every kernel going through the mapper.
+        recorded, gates_recorded = self.simulate(
+            DeutschJozsa(),
+            mapper_cmd('fast_path', 'no'),
+            mapper_cmd('record', trace_fname))
+        kernels = recorded['kernels']['mapped'] + recorded['kernels']['cached']
+        self.assertGreater(kernels, 0)
+
+        # Replaying it must take every kernel from the trace, and send the
+        # same gates downstream.
+        replayed, gates_replayed = self.simulate(
+            DeutschJozsa(),
+            mapper_cmd('fast_path', 'no'),
+            mapper_cmd('replay', trace_fname))
+        self.assertEqual(replayed['kernels']['replayed'], kernels)
+        self.assertEqual(replayed['kernels']['mapped'], 0)
+        self.assertEqual(gates_replayed, gates_recorded)
+
+    def test_replay_corrupt(self):
+        trace_fname = self.tmpdir.name + os.sep + 'trace.bin'
+
+        def simulate(oper, value):
+            self.simulate(
+                DeutschJozsa(),
+                mapper_cmd('fast_path', 'no'),
+                mapper_cmd(oper, value))
+
+        simulate('record', trace_fname)
+        with open(trace_fname, 'rb') as f:
+            data = bytearray(f.read())
+
+        # Skip the header: magic number, version, and gate names.
+        offset = 12
+        num_names, = struct.unpack_from('=I', data, offset)
+        offset += 4
+        for _ in range(num_names):
+            length, = struct.unpack_from('=I', data, offset)
+            offset += 4 + length
+        first_record = offset
+
+        # Skip the hash, the gates, and the initial placement of the first
+        # record, to get to its resulting placement.
+        offset += 8
+        num_gates, = struct.unpack_from('=I', data, offset)
+        offset += 4
+        for _ in range(num_gates):
+            num_qubits = data[offset + 4]
+            offset += 5 + 4 * num_qubits + 8
+        num_qubits, = struct.unpack_from('=I', data, offset)
+        offset += 4 + 4 * num_qubits
+        self.assertGreater(struct.unpack_from('=I', data, offset)[0], 0)
+
+        # Replaying a trace truncated in the middle of the first record
+        # must fail.
+        with open(trace_fname, 'wb') as f:
+            f.write(data[:first_record + 10])
+        with self.assertRaises(RuntimeError):
+            simulate('replay', trace_fname)
+
+        # Replaying a trace that maps a qubit to a physical qubit that
+        # doesn't exist must fail.
+        struct.pack_into('=I', data, offset + 4, 0xFFFFFFFE)
+        with open(trace_fname, 'wb') as f:
+            f.write(data)
+        with self.assertRaises(RuntimeError):
+            simulate('replay', trace_fname)
+
+    def test_kernel_cache(self):
+
+        # Bypass the fast path, so every kernel would go through the mapper.
+        stats_uncached, gates_uncached = self.simulate(
+            RepeatedDeutschJozsa(),
+            mapper_cmd('fast_path', 'no'),
+            mapper_cmd('kernel_cache', '0'))
+        stats_cached, gates_cached = self.simulate(
+            RepeatedDeutschJozsa(),
+            mapper_cmd('fast_path', 'no'))
+        self.assertEqual(stats_uncached['kernel_cache']['hits'], 0)
+        self.assertGreater(stats_cached['kernel_cache']['hits'], 0)
+        self.assertEqual(stats_cached['kernels']['cached'], stats_cached['kernel_cache']['hits'])
+        self.assertEqual(
+            stats_cached['kernels']['mapped'] + stats_cached['kernels']['cached'],
+            stats_uncached['kernels']['mapped'])
+        self.assertEqual(gates_cached, gates_uncached)
+
+    def test_detect_cache(self):
+        stats_uncached, gates_uncached = self.simulate(
+            RepeatedDeutschJozsa(),
+            mapper_cmd('detect_cache', '0'))
+        stats_cached, gates_cached = self.simulate(
+            RepeatedDeutschJozsa())
+        self.assertEqual(stats_uncached['detect_cache']['hits'], 0)
+        self.assertGreater(stats_cached['detect_cache']['hits'], 0)
+        self.assertEqual(stats_cached['gates_in'], stats_uncached['gates_in'])
+        self.assertEqual(gates_cached, gates_uncached)
+
+    def test_window(self):
+        stats, gates = self.simulate(RepeatedDeutschJozsa())
+        self.assertEqual(stats['kernels']['window_flushes'], 0)
+
+        # Each kernel consists of eight gates, the sixth of which is the
+        # cnot, so the first window includes all gates needed for the initial
+        # placement.
+        stats_gates, gates_gates = self.simulate(
+            RepeatedDeutschJozsa(),
+            mapper_cmd('window_gates', '6'))
+        self.assertGreater(stats_gates['kernels']['window_flushes'], 0)
+        self.assertEqual(per_qubit(gates_gates), per_qubit(gates))
+
+        # Similarly, the cnot is at depth four.
+        stats_depth, gates_depth = self.simulate(
+            RepeatedDeutschJozsa(),
+            mapper_cmd('window_depth', '4'))
+        self.assertGreater(stats_depth['kernels']['window_flushes'], 0)
+        self.assertEqual(per_qubit(gates_depth), per_qubit(gates))
+
+    def test_snapshot(self):
+        snap_fname = self.tmpdir.name + os.sep + 'platform.snap'
+        subprocess.check_call([
+            'dqcsopopenql-mapper-snapshot',
+            self.plat_fname, self.gate_fname, snap_fname])
+
+        # Use a circuit that needs routing, so the routing tables from the
+        # snapshot are actually used.
+        stats, gates = self.simulate(RoutedDeutschJozsa())
+        stats_snap, gates_snap = self.simulate(
+            RoutedDeutschJozsa(),
+            env={'DQCSIM_OPENQL_SNAPSHOT': snap_fname})
+        self.assertEqual(stats_snap['gates_in'], stats['gates_in'])
+        self.assertEqual(stats_snap['swaps_inserted'], stats['swaps_inserted'])
+        self.assertEqual(gates_snap, gates)
+
+    def test_coalesce(self):
+        stats_split, gates_split = self.simulate(
+            RegisterMeasurement(),
+            mapper_cmd('coalesce', 'no'))
+        stats, gates = self.simulate(RegisterMeasurement())
+        self.assertEqual(stats_split['gates_coalesced'], 0)
+        self.assertGreater(stats['gates_coalesced'], 0)
+
+        # Each coalesced gate saves a downstream gate, and all other gates
+        # are unaffected.
+        self.assertEqual(len(gates), len(gates_split) - stats['gates_coalesced'])
+        self.assertEqual(
+            [gate for gate in gates if gate[0] == 'unitary'],
+            [gate for gate in gates_split if gate[0] == 'unitary'])
+        coalesced = [gate for gate in gates if gate[0] != 'unitary']
+        self.assertTrue(any(len(gate[1]) > 1 for gate in coalesced))
+        self.assertEqual(
+            sorted(qubit for gate in coalesced for qubit in gate[1]),
+            sorted(qubit for gate in gates_split if gate[0] != 'unitary' for qubit in gate[1]))
+
+    def test_swaps_decomposed(self):
+
+        # Swaps inserted by the mapper must be counted even if they reach us
+        # as cnots, or the swaps trial metric can't tell the trials apart.
+        self.write_decomposing_platform()
+        stats, gates = self.simulate(RoutedDeutschJozsa())
+        self.assertGreater(stats['swaps_inserted'], 0)
+        self.assertFalse(any(
+            gate[0] == 'unitary' and len(gate[1]) == 2 and not gate[2]
+            for gate in gates))
@@ -94,6 +94,7 @@ setup(
     data_files = [
         ('bin', [
             output_dir + '/dqcsopopenql-mapper',
+            output_dir + '/dqcsopopenql-mapper-snapshot',
         ]),
     ],
 
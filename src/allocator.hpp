@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * Allocator for a fixed number of qubit indices.
+ *
+ * The allocation state is stored as a bitset, with set bits representing
+ * allocated qubits. Allocation returns the lowest free index, found using
+ * find-first-zero over 64-bit words, so the result only depends on the
+ * sequence of allocations and frees; runs remain reproducible. To avoid
+ * scanning the fully-allocated words at the start of the bitset over and over
+ * again, we keep track of the lowest word that may have a free bit in it.
+ */
+class QubitAllocator {
+private:
+
+  // Allocation bitset. Bits beyond the qubit count are permanently set.
+  std::vector<uint64_t> words;
+
+  // Index of the lowest word that may contain a free bit.
+  size_t hint = 0;
+
+public:
+
+  /**
+   * Constructs an allocator for the given number of qubits, all of which are
+   * initially free.
+   */
+  QubitAllocator(size_t num_qubits = 0) {
+    reset(num_qubits);
+  }
+
+  /**
+   * Resets the allocator for the given number of qubits, all of which are
+   * initially free.
+   */
+  void reset(size_t num_qubits) {
+    words.assign((num_qubits + 63) / 64, 0);
+    if (num_qubits % 64) {
+      words.back() = ~(uint64_t)0 << (num_qubits % 64);
+    }
+    hint = 0;
+  }
+
+  /**
+   * Allocates the lowest free qubit index. Returns -1 if all qubits are in
+   * use.
+   */
+  ssize_t allocate() {
+    for (; hint < words.size(); hint++) {
+      uint64_t word = words[hint];
+      if (~word) {
+        size_t bit = __builtin_ctzll(~word);
+        words[hint] = word | ((uint64_t)1 << bit);
+        return hint * 64 + bit;
+      }
+    }
+    return -1;
+  }
+
+  /**
+   * Frees the given qubit index. No-op if it is not allocated.
+   */
+  void release(size_t qubit) {
+    size_t word = qubit / 64;
+    if (word >= words.size()) {
+      return;
+    }
+    words[word] &= ~((uint64_t)1 << (qubit % 64));
+    if (word < hint) {
+      hint = word;
+    }
+  }
+
+};
@@ -1,5 +1,7 @@
-#include <unordered_map>
-#include <utility>
+#pragma once
+
+#include <sys/types.h>
+#include <vector>
 
 /**
  * Represents a bidirectional map from one qubit index space to another.
@@ -10,36 +12,142 @@
  *     | upstream |-----------| downstream |
  *     |  space   |<----------|   space    |
  *     '----------'  reverse  '------------'
+ *
+ * Qubit indices are small and dense, so both directions are stored as flat
+ * vectors indexed by qubit, with UNMAPPED as the sentinel for qubits that
+ * have no mapping. The vectors grow as needed, and their capacity is reused
+ * for the lifetime of the map.
+ *
+ * Upstream indices need not stay small, though: DQCsim never reuses qubit
+ * indices, so with qubits being allocated and freed all the time, the
+ * upstream indices in use keep increasing. The forward vector therefore
+ * starts at an offset, which is advanced past the unmapped entries at its
+ * start when those make up at least half of it, so its size is bounded by
+ * about twice the range of upstream indices in use.
  */
 class QubitBiMap {
+public:
+
+  /**
+   * Sentinel value for qubits that are not mapped. This is the same value
+   * that OpenQL uses for `UNDEFINED_QUBIT`.
+   */
+  enum : size_t { UNMAPPED = (size_t)-1 };
+
 private:
-  std::unordered_map<size_t, size_t> forward;
-  std::unordered_map<size_t, size_t> reverse;
+
+  // The forward direction, indexed by upstream qubit minus forward_base.
+  // Entries before forward_begin are all unmapped.
+  std::vector<size_t> forward;
+  size_t forward_base = 0;
+  size_t forward_begin = 0;
+
+  // The reverse direction, indexed by downstream qubit.
+  std::vector<size_t> reverse;
+
+  /**
+   * Returns the entry for the given index, or UNMAPPED if it is out of range.
+   */
+  static size_t get(const std::vector<size_t> &vec, size_t index) {
+    if (index < vec.size()) {
+      return vec[index];
+    }
+    return UNMAPPED;
+  }
+
+  /**
+   * Sets the entry for the given index, growing the vector if needed.
+   */
+  static void set(std::vector<size_t> &vec, size_t index, size_t value) {
+    if (index >= vec.size()) {
+      vec.resize(index + 1, UNMAPPED);
+    }
+    vec[index] = value;
+  }
+
+  /**
+   * Returns the forward entry for the given upstream qubit, or UNMAPPED if it
+   * is out of range.
+   */
+  size_t get_forward(size_t upstream) const {
+    if (upstream < forward_base) {
+      return UNMAPPED;
+    }
+    return get(forward, upstream - forward_base);
+  }
+
+  /**
+   * Sets the forward entry for the given upstream qubit, growing the vector
+   * if needed.
+   */
+  void set_forward(size_t upstream, size_t value) {
+    if (upstream < forward_base) {
+      size_t grow = forward_base - upstream;
+      forward.insert(forward.begin(), grow, UNMAPPED);
+      forward_base = upstream;
+      forward_begin += grow;
+    }
+    size_t index = upstream - forward_base;
+    set(forward, index, value);
+    if (index < forward_begin) {
+      forward_begin = index;
+    }
+  }
+
+  /**
+   * Clears the forward entry for the given upstream qubit, which must be
+   * mapped, and drops the unmapped entries at the start of the forward
+   * vector if they make up at least half of it.
+   */
+  void clear_forward(size_t upstream) {
+    forward[upstream - forward_base] = UNMAPPED;
+    while (forward_begin < forward.size() && forward[forward_begin] == UNMAPPED) {
+      forward_begin++;
+    }
+    if (forward_begin * 2 >= forward.size()) {
+      forward.erase(forward.begin(), forward.begin() + forward_begin);
+      forward_base += forward_begin;
+      forward_begin = 0;
+    }
+  }
 
 public:
 
+  /**
+   * Reserves space for the given number of upstream and downstream qubits.
+   */
+  void reserve(size_t num_upstream, size_t num_downstream) {
+    if (forward_base + forward.size() < num_upstream) {
+      forward.resize(num_upstream - forward_base, UNMAPPED);
+    }
+    if (reverse.size() < num_downstream) {
+      reverse.resize(num_downstream, UNMAPPED);
+    }
+  }
+
+  /**
+   * Removes all mappings, without releasing memory.
+   */
+  void clear() {
+    forward.assign(forward.size(), UNMAPPED);
+    forward_begin = forward.size();
+    reverse.assign(reverse.size(), UNMAPPED);
+  }
+
   /**
    * Given an upstream qubit, returns the downstream qubit, if any. If there is
    * no mapping, returns -1.
    */
-  ssize_t forward_lookup(size_t upstream) {
-    auto iter = forward.find(upstream);
-    if (iter != forward.end()) {
-      return iter->second;
-    }
-    return -1;
+  ssize_t forward_lookup(size_t upstream) const {
+    return (ssize_t)get_forward(upstream);
   }
 
   /**
    * Given a downstream qubit, returns the upstream qubit, if any. If there is
    * no mapping, returns -1.
    */
-  ssize_t reverse_lookup(size_t downstream) {
-    auto iter = reverse.find(downstream);
-    if (iter != reverse.end()) {
-      return iter->second;
-    }
-    return -1;
+  ssize_t reverse_lookup(size_t downstream) const {
+    return (ssize_t)get(reverse, downstream);
   }
 
   /**
@@ -47,10 +155,10 @@ public:
    * No-op if already unmapped.
    */
   void unmap_upstream(size_t upstream) {
-    auto iter = forward.find(upstream);
-    if (iter != forward.end()) {
-      reverse.erase(iter->second);
-      forward.erase(iter);
+    size_t downstream = get_forward(upstream);
+    if (downstream != UNMAPPED) {
+      reverse[downstream] = UNMAPPED;
+      clear_forward(upstream);
     }
   }
 
@@ -59,10 +167,10 @@ public:
    * No-op if already unmapped.
    */
   void unmap_downstream(size_t downstream) {
-    auto iter = reverse.find(downstream);
-    if (iter != reverse.end()) {
-      forward.erase(iter->second);
-      reverse.erase(iter);
+    size_t upstream = get(reverse, downstream);
+    if (upstream != UNMAPPED) {
+      clear_forward(upstream);
+      reverse[downstream] = UNMAPPED;
     }
   }
 
@@ -73,8 +181,8 @@ public:
   void map(size_t upstream, size_t downstream) {
     unmap_upstream(upstream);
     unmap_downstream(downstream);
-    forward.emplace(std::make_pair(upstream, downstream));
-    reverse.emplace(std::make_pair(downstream, upstream));
+    set_forward(upstream, downstream);
+    set(reverse, downstream, upstream);
   }
 
 };
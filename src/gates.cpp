@@ -2,6 +2,7 @@
 #include <cctype>
 #include <cmath>
 #include <complex>
+#include <cstring>
 #include <gates.hpp>
 
 // Alias the dqcsim::wrap namespace to something shorter.
@@ -16,9 +17,9 @@ static inline std::string &&lowercase(std::string &&s) {
 }
 
 /**
- * Constructs the gate map.
+ * Constructs the gate map from its JSON description.
  */
-void OpenQLGateMap::initialize(const nlohmann::json &json, double epsilon) {
+void OpenQLGateMap::initialize(const nlohmann::json &json) {
 
   // We need to add the parameterized gates to the DQCsim gatemap after adding
   // all non-parameterized gates, otherwise a parameterized gate may be
@@ -67,28 +68,206 @@ void OpenQLGateMap::initialize(const nlohmann::json &json, double epsilon) {
     }
   }
 
-  // Add the non-parameterized gates to the DQCsim gatemap.
+  // Parse the entries, non-parameterized gates first. The gate IDs are
+  // assigned in this order.
+  specs.clear();
   for (auto const &record : fixed) {
-    add_mapping(record.first, record.second, epsilon);
+    specs.push_back(parse_mapping(record.first, record.second));
   }
-
-  // Add the parameterized gates to the DQCsim gatemap.
   for (auto const &record : parameterized) {
-    has_angle.insert(record.first);
-    add_mapping(record.first, record.second, epsilon);
+    specs.push_back(parse_mapping(record.first, record.second));
+    specs.back().has_angle = true;
+  }
+
+  initialize_specs();
+}
+
+/**
+ * Constructs the gate map from the parsed entries in specs.
+ */
+void OpenQLGateMap::initialize_specs() {
+
+  // Add the gates to the DQCsim gatemap.
+  for (const OpenQLGateSpec &spec : specs) {
+    add_mapping(spec);
+  }
+
+  // Prebuild the templates for the non-parameterized gates.
+  templates.resize(gates.size());
+  for (size_t id = 0; id < gates.size(); id++) {
+    if (!gates[id].has_angle) {
+      templates[id] = build_template(id, 0.0);
+    }
+  }
+
+  build_index();
+}
+
+/**
+ * Builds the index over the unitary gates and the gatemaps for its guards.
+ * The matrices of the non-parameterized gates are taken from their
+ * templates, so they are exactly what DQCsim constructs for them.
+ */
+void OpenQLGateMap::build_index() {
+  for (size_t id = 0; id < gates.size(); id++) {
+    const OpenQLGateSpec &spec = specs[id];
+    const OpenQLGateInfo &info = gates[id];
+    if (spec.kind == OpenQLGateSpec::Kind::Measure || spec.kind == OpenQLGateSpec::Kind::Prep) {
+      continue;
+    }
+    if (info.has_angle) {
+      if (spec.kind == OpenQLGateSpec::Kind::Predefined) {
+        if (spec.predefined == dqcs::PredefinedGate::RX) {
+          index.add_rotation(id, info.num_controls, UnitaryIndex::Axis::X);
+          continue;
+        } else if (spec.predefined == dqcs::PredefinedGate::RY) {
+          index.add_rotation(id, info.num_controls, UnitaryIndex::Axis::Y);
+          continue;
+        } else if (spec.predefined == dqcs::PredefinedGate::RZ) {
+          index.add_rotation(id, info.num_controls, UnitaryIndex::Axis::Z);
+          continue;
+        }
+      }
+    } else if (templates[id] && templates[id]->type == dqcs::GateType::Unitary) {
+      index.add_matrix(id, info.num_controls, templates[id]->matrix.get());
+      continue;
+    }
+    index.add_unindexed(id, info.num_controls, info.num_targets);
+  }
+  index.build();
+
+  // The guards are tried one by one, each using a DQCsim gatemap with just
+  // that entry.
+  guard_maps.clear();
+  guard_maps.resize(gates.size());
+  for (size_t id = 0; id < gates.size(); id++) {
+    if (!index.is_guard(id)) {
+      continue;
+    }
+    const OpenQLGateSpec &spec = specs[id];
+    guard_maps[id].reset(new dqcs::GateMap<size_t>());
+    if (spec.kind == OpenQLGateSpec::Kind::Unitary) {
+      dqcs::Matrix matrix(spec.matrix_qubits, spec.matrix.data());
+      guard_maps[id]->with_unitary(id, matrix, spec.controlled, epsilon);
+    } else {
+      guard_maps[id]->with_unitary(id, spec.predefined, spec.controlled, epsilon);
+    }
+  }
+}
+
+/**
+ * Builds the template for constructing the given gate with the given angle,
+ * by constructing it once through the DQCsim gatemap. Returns null if the
+ * gate can't be represented by a template, in which case it must be
+ * constructed through the DQCsim gatemap every time.
+ */
+std::unique_ptr<OpenQLGateMap::GateTemplate> OpenQLGateMap::build_template(
+  size_t id,
+  double angle
+) {
+  const OpenQLGateInfo &info = gates[id];
+  try {
+    dqcs::QubitSet qubits;
+    for (size_t qubit = 1; qubit <= info.num_controls + info.num_targets; qubit++) {
+      qubits.push(dqcs::QubitRef(qubit));
+    }
+    dqcs::ArbData params;
+    if (info.has_angle) {
+      params.push_arb_arg(angle);
+    }
+    dqcs::Gate gate = map.construct(id, std::move(qubits), std::move(params));
+
+    // Only plain unitary, measurement, and prep gates without any attached
+    // data can be built from just a matrix.
+    if (gate.get_type() == dqcs::GateType::Custom || !gate.has_matrix()) {
+      return nullptr;
+    }
+    if (gate.get_arb_arg_count() || gate.get_arb_json_string() != "{}") {
+      return nullptr;
+    }
+    return std::unique_ptr<GateTemplate>(
+      new GateTemplate{gate.get_type(), gate.get_matrix()});
+
+  } catch (const std::exception &e) {
+    DQCSIM_DEBUG(
+      "Cannot build template for OpenQL gate %s: %s",
+      info.name.c_str(), e.what());
+    return nullptr;
   }
+}
+
+/**
+ * Returns the template for constructing the given gate, building it if
+ * needed, or null if the gate has no template.
+ */
+const OpenQLGateMap::GateTemplate *OpenQLGateMap::get_template(
+  const OpenQLGateDescription &desc
+) {
+  if (!gates[desc.id].has_angle) {
+    return templates[desc.id].get();
+  }
+
+  // Look for the template for this angle in the cache, or build it if it
+  // isn't in there yet.
+  if (!template_cache_capacity) {
+    return nullptr;
+  }
+  uint64_t angle_bits;
+  static_assert(sizeof(angle_bits) == sizeof(desc.angle), "unexpected double size");
+  std::memcpy(&angle_bits, &desc.angle, sizeof(angle_bits));
+  std::pair<size_t, uint64_t> key(desc.id, angle_bits);
+  auto iter = template_cache.find(key);
+  if (iter != template_cache.end()) {
+    template_cache_hits++;
+    return iter->second.get();
+  }
+  template_cache_misses++;
+  if (template_cache.size() >= template_cache_capacity) {
+    template_cache.clear();
+    template_cache_clears++;
+  }
+  return template_cache.emplace(key, build_template(desc.id, desc.angle)).first->second.get();
+}
+
+/**
+ * Returns the ID for the given OpenQL gate name, assigning a new one if it
+ * doesn't have one yet.
+ */
+size_t OpenQLGateMap::intern(const std::string &openql) {
+  auto it = ids.find(openql);
+  if (it != ids.end()) {
+    return it->second;
+  }
+  size_t id = gates.size();
+  gates.emplace_back();
+  gates.back().name = openql;
+  ids.emplace(openql, id);
+  return id;
+}
 
+/**
+ * Returns the ID of the OpenQL gate with the given name.
+ *
+ * \throws UnknownGateException if the OpenQL gate was not recognized.
+ */
+size_t OpenQLGateMap::get_id(const std::string &name) const {
+  auto it = ids.find(name);
+  if (it == ids.end()) {
+    throw UnknownGateException("unknown OpenQL gate " + name);
+  }
+  return it->second;
 }
 
 /**
- * Adds a mapping to the DQCsim gate map.
+ * Parses and validates a JSON gatemap entry.
  */
-void OpenQLGateMap::add_mapping(
+OpenQLGateSpec OpenQLGateMap::parse_mapping(
   const std::string &openql,
-  const nlohmann::json &desc,
-  double epsilon
+  const nlohmann::json &desc
 ) {
   try {
+    OpenQLGateSpec spec;
+    spec.name = openql;
 
     // Load the gate type.
     std::string typ = lowercase(desc["type"]);
@@ -157,125 +336,231 @@ void OpenQLGateMap::add_mapping(
         throw std::runtime_error("unknown basis " + basis);
       }
     }
+    spec.matrix_qubits = matrix.num_qubits();
+    spec.matrix = matrix.get();
 
     // Handle measurement and prep.
     if (typ == "measure") {
-      is_multi_qubit_parallel.insert(openql);
-      map.with_measure(openql, matrix, epsilon);
-      DQCSIM_DEBUG("Registered measurement for %s into gatemap", openql.c_str());
-      return;
+      spec.kind = OpenQLGateSpec::Kind::Measure;
+      return spec;
     }
     if (typ == "prep") {
-      is_multi_qubit_parallel.insert(openql);
-      map.with_prep(openql, matrix, epsilon);
-      DQCSIM_DEBUG("Registered prep for %s into gatemap", openql.c_str());
-      return;
+      spec.kind = OpenQLGateSpec::Kind::Prep;
+      return spec;
     }
 
     // Everything else is a normal unitary gate, and can thus be turned into a
     // controlled gate.
-    size_t controlled = 0;
     it = desc.find("controlled");
     if (it != desc.end()) {
-      controlled = it.value();
+      spec.controlled = it.value();
     }
 
     // Handle custom unitary gates.
     if (typ == "unitary") {
-      map.with_unitary(openql, matrix, controlled, epsilon);
-      DQCSIM_DEBUG(
-        "Registered custom unitary with %d control qubit(s) for %s into gatemap",
-        (int)controlled, openql.c_str());
-      return;
+      spec.kind = OpenQLGateSpec::Kind::Unitary;
+      return spec;
     }
 
     // Handle predefined gates.
-    dqcs::PredefinedGate gate;
+    spec.kind = OpenQLGateSpec::Kind::Predefined;
+    spec.matrix_qubits = 0;
+    spec.matrix.clear();
     if (typ == "i") {
-      gate = dqcs::PredefinedGate::I;
+      spec.predefined = dqcs::PredefinedGate::I;
     } else if (typ == "x") {
-      gate = dqcs::PredefinedGate::X;
+      spec.predefined = dqcs::PredefinedGate::X;
     } else if (typ == "y") {
-      gate = dqcs::PredefinedGate::Y;
+      spec.predefined = dqcs::PredefinedGate::Y;
     } else if (typ == "z") {
-      gate = dqcs::PredefinedGate::Z;
+      spec.predefined = dqcs::PredefinedGate::Z;
     } else if (typ == "h") {
-      gate = dqcs::PredefinedGate::H;
+      spec.predefined = dqcs::PredefinedGate::H;
     } else if (typ == "s") {
-      gate = dqcs::PredefinedGate::S;
+      spec.predefined = dqcs::PredefinedGate::S;
     } else if (typ == "s_dag") {
-      gate = dqcs::PredefinedGate::S_DAG;
+      spec.predefined = dqcs::PredefinedGate::S_DAG;
     } else if (typ == "t") {
-      gate = dqcs::PredefinedGate::T;
+      spec.predefined = dqcs::PredefinedGate::T;
     } else if (typ == "t_dag") {
-      gate = dqcs::PredefinedGate::T_DAG;
+      spec.predefined = dqcs::PredefinedGate::T_DAG;
     } else if (typ == "rx_90") {
-      gate = dqcs::PredefinedGate::RX_90;
+      spec.predefined = dqcs::PredefinedGate::RX_90;
     } else if (typ == "rx_m90") {
-      gate = dqcs::PredefinedGate::RX_M90;
+      spec.predefined = dqcs::PredefinedGate::RX_M90;
     } else if (typ == "rx_180") {
-      gate = dqcs::PredefinedGate::RX_180;
+      spec.predefined = dqcs::PredefinedGate::RX_180;
     } else if (typ == "rx") {
-      gate = dqcs::PredefinedGate::RX;
+      spec.predefined = dqcs::PredefinedGate::RX;
     } else if (typ == "ry_90") {
-      gate = dqcs::PredefinedGate::RY_90;
+      spec.predefined = dqcs::PredefinedGate::RY_90;
     } else if (typ == "ry_m90") {
-      gate = dqcs::PredefinedGate::RY_M90;
+      spec.predefined = dqcs::PredefinedGate::RY_M90;
     } else if (typ == "ry_180") {
-      gate = dqcs::PredefinedGate::RY_180;
+      spec.predefined = dqcs::PredefinedGate::RY_180;
     } else if (typ == "ry") {
-      gate = dqcs::PredefinedGate::RY;
+      spec.predefined = dqcs::PredefinedGate::RY;
     } else if (typ == "rz_90") {
-      gate = dqcs::PredefinedGate::RZ_90;
+      spec.predefined = dqcs::PredefinedGate::RZ_90;
     } else if (typ == "rz_m90") {
-      gate = dqcs::PredefinedGate::RZ_M90;
+      spec.predefined = dqcs::PredefinedGate::RZ_M90;
     } else if (typ == "rz_180") {
-      gate = dqcs::PredefinedGate::RZ_180;
+      spec.predefined = dqcs::PredefinedGate::RZ_180;
     } else if (typ == "rz") {
-      gate = dqcs::PredefinedGate::RZ;
+      spec.predefined = dqcs::PredefinedGate::RZ;
     } else if (typ == "phase") {
-      gate = dqcs::PredefinedGate::Phase;
+      spec.predefined = dqcs::PredefinedGate::Phase;
     } else if (typ == "swap") {
-      gate = dqcs::PredefinedGate::Swap;
+      spec.predefined = dqcs::PredefinedGate::Swap;
     } else if (typ == "sqswap") {
-      gate = dqcs::PredefinedGate::SqSwap;
+      spec.predefined = dqcs::PredefinedGate::SqSwap;
     } else {
       throw std::runtime_error("unknown gate type " + typ);
     }
-    map.with_unitary(openql, gate, controlled, epsilon);
+    return spec;
+
+  } catch (const std::exception& e) {
+    throw std::runtime_error("while parsing gatemap entry for " + openql + ": " + e.what());
+  }
+}
+
+/**
+ * Adds a parsed mapping to the DQCsim gate map.
+ */
+void OpenQLGateMap::add_mapping(const OpenQLGateSpec &spec) {
+  size_t id = intern(spec.name);
+  OpenQLGateInfo &info = gates[id];
+  info.has_angle = spec.has_angle;
+  try {
+
+    // Handle measurement and prep.
+    if (spec.kind == OpenQLGateSpec::Kind::Measure
+      || spec.kind == OpenQLGateSpec::Kind::Prep
+    ) {
+      dqcs::Matrix matrix(spec.matrix_qubits, spec.matrix.data());
+      info.multi_qubit_parallel = true;
+      info.num_targets = 1;
+      if (spec.kind == OpenQLGateSpec::Kind::Measure) {
+        info.measure = true;
+        map.with_measure(id, matrix, epsilon);
+        DQCSIM_DEBUG("Registered measurement for %s into gatemap", spec.name.c_str());
+      } else {
+        map.with_prep(id, matrix, epsilon);
+        DQCSIM_DEBUG("Registered prep for %s into gatemap", spec.name.c_str());
+      }
+      return;
+    }
+    info.num_controls = spec.controlled;
+
+    // Handle custom unitary gates.
+    if (spec.kind == OpenQLGateSpec::Kind::Unitary) {
+      dqcs::Matrix matrix(spec.matrix_qubits, spec.matrix.data());
+      info.num_targets = spec.matrix_qubits;
+      map.with_unitary(id, matrix, spec.controlled, epsilon);
+      DQCSIM_DEBUG(
+        "Registered custom unitary with %d control qubit(s) for %s into gatemap",
+        (int)spec.controlled, spec.name.c_str());
+      return;
+    }
+
+    // Handle predefined gates.
+    info.num_targets = 1;
+    if (spec.predefined == dqcs::PredefinedGate::Swap) {
+      info.num_targets = 2;
+      if (!spec.controlled) {
+        info.swap = true;
+      }
+    } else if (spec.predefined == dqcs::PredefinedGate::SqSwap) {
+      info.num_targets = 2;
+    }
+    map.with_unitary(id, spec.predefined, spec.controlled, epsilon);
     DQCSIM_DEBUG(
       "Registered predefined unitary with %d control qubit(s) for %s into gatemap",
-      (int)controlled, openql.c_str());
+      (int)spec.controlled, spec.name.c_str());
 
   } catch (const std::exception& e) {
-    throw std::runtime_error("while parsing gatemap entry for " + openql + ": " + e.what());
+    throw std::runtime_error("while parsing gatemap entry for " + spec.name + ": " + e.what());
   }
 }
 
 /**
- * Converts a DQCsim gate to a record from which an OpenQL gate can be
- * constructed.
- *
- * \throws UnknownGateException if the DQCsim gate was not recognized.
+ * Appends the indices of the qubits in the given set to the given vector.
  */
-OpenQLGateDescription OpenQLGateMap::detect(const dqcs::Gate &gate) {
+static void append_qubits(std::vector<size_t> &vec, dqcs::QubitSet &&qubits) {
+  while (qubits.size()) {
+    vec.push_back(qubits.pop().get_index());
+  }
+}
 
-  // Detect using the gate map.
-  const std::string *openql;
-  dqcs::QubitSet qubits = dqcs::QubitSet(0);
-  dqcs::ArbData params = dqcs::ArbData(0);
-  bool detected = map.detect(gate, &openql, &qubits, &params);
-  if (!detected) {
-    DQCSIM_DEBUG("Gate detection failed! Dump: %s", gate.dump().c_str());
-    throw UnknownGateException("failed to convert an incoming gate to its OpenQL representation");
+/**
+ * Appends a length-prefixed string to a fingerprint.
+ */
+static void append_string(std::string &fp, const std::string &s) {
+  size_t len = s.size();
+  fp.append(reinterpret_cast<const char*>(&len), sizeof(len));
+  fp.append(s);
+}
+
+/**
+ * Stores the operands of the given gate in the given vector; that is, its
+ * controls, followed by its targets, followed by its measured qubits.
+ */
+static void operands(const dqcs::Gate &gate, std::vector<size_t> &result) {
+  result.clear();
+  if (gate.has_controls()) {
+    append_qubits(result, gate.get_controls());
+  }
+  if (gate.has_targets()) {
+    append_qubits(result, gate.get_targets());
+  }
+  if (gate.has_measures()) {
+    append_qubits(result, gate.get_measures());
   }
+}
 
-  // Construct the gate description object.
-  OpenQLGateDescription desc;
-  desc.name = *openql;
+/**
+ * Computes an exact fingerprint of everything that gate detection depends
+ * on, except for the qubits themselves. That is, the type of gate, the
+ * number of control, target and measured qubits, the exact bytes of the
+ * matrix, and the parameterization data. The fingerprint is stored in the
+ * given string.
+ */
+static void fingerprint(const dqcs::Gate &gate, std::string &fp) {
+  fp.clear();
+  size_t header[4] = {
+    (size_t)gate.get_type(),
+    gate.has_controls() ? gate.get_controls().size() : 0,
+    gate.has_targets() ? gate.get_targets().size() : 0,
+    gate.has_measures() ? gate.get_measures().size() : 0
+  };
+  fp.append(reinterpret_cast<const char*>(header), sizeof(header));
+  if (gate.has_matrix()) {
+    std::vector<dqcs::complex> entries = gate.get_matrix().get();
+    fp.append(
+      reinterpret_cast<const char*>(entries.data()),
+      entries.size() * sizeof(dqcs::complex));
+  }
+  append_string(fp, gate.get_arb_json_string());
+  size_t nargs = gate.get_arb_arg_count();
+  for (size_t i = 0; i < nargs; i++) {
+    append_string(fp, gate.get_arb_arg_string(i));
+  }
+}
+
+/**
+ * Converts the result of DQCsim gate detection to a gate description.
+ */
+void OpenQLGateMap::convert_detected(
+  size_t id,
+  dqcs::QubitSet &&qubits,
+  dqcs::ArbData &params,
+  OpenQLGateDescription &desc
+) const {
+  desc.id = id;
+  const OpenQLGateInfo &info = gates[desc.id];
 
   // Handle gates parameterized with an angle.
-  if (has_angle.count(desc.name)) {
+  if (info.has_angle) {
     desc.angle = params.pop_arb_arg_as<double>();
   } else {
     desc.angle = 0.0;
@@ -283,11 +568,126 @@ OpenQLGateDescription OpenQLGateMap::detect(const dqcs::Gate &gate) {
 
   // Handle gates that should be deconstructed into multiple parallel
   // single-qubit gates (measurement and prep gates).
-  desc.multi_qubit_parallel = is_multi_qubit_parallel.count(desc.name) > 0;
+  desc.multi_qubit_parallel = info.multi_qubit_parallel;
 
   // Convert the qubit references.
-  while (qubits.size()) {
-    desc.qubits.push_back(qubits.pop().get_index());
+  desc.qubits.clear();
+  append_qubits(desc.qubits, std::move(qubits));
+}
+
+/**
+ * Tries to detect the given gate using the index. Returns false if the index
+ * can't tell, in which case the DQCsim gatemap must be used.
+ */
+bool OpenQLGateMap::detect_indexed(const dqcs::Gate &gate, OpenQLGateDescription &desc) {
+
+  // Only plain unitary gates without attached data are indexed.
+  if (gate.get_type() != dqcs::GateType::Unitary || !gate.has_matrix() || gate.has_measures()) {
+    return false;
+  }
+  if (gate.get_arb_arg_count() || gate.get_arb_json_string() != "{}") {
+    return false;
+  }
+  size_t controls = gate.has_controls() ? gate.get_controls().size() : 0;
+  size_t id;
+  double angle = 0.0;
+  const std::vector<size_t> *guards;
+  UnitaryIndex::Result result = index.find(controls, gate.get_matrix().get(), id, angle, guards);
+  if (!guards || result == UnitaryIndex::Result::Uncertain) {
+    return false;
+  }
+
+  // The guards with a lower ID than the match would be detected first by
+  // the DQCsim gatemap, so try those first.
+  for (size_t guard : *guards) {
+    if (result == UnitaryIndex::Result::Found && guard >= id) {
+      break;
+    }
+    const size_t *guard_id;
+    dqcs::QubitSet qubits = dqcs::QubitSet(0);
+    dqcs::ArbData params = dqcs::ArbData(0);
+    if (guard_maps[guard]->detect(gate, &guard_id, &qubits, &params)) {
+      convert_detected(*guard_id, std::move(qubits), params, desc);
+      return true;
+    }
+  }
+  if (result != UnitaryIndex::Result::Found) {
+    return false;
+  }
+
+  // The qubits of a gate detected by the index are simply its controls
+  // followed by its targets.
+  desc.id = id;
+  desc.angle = gates[id].has_angle ? angle : 0.0;
+  desc.multi_qubit_parallel = false;
+  operands(gate, desc.qubits);
+  return true;
+}
+
+/**
+ * Converts a DQCsim gate to a record from which an OpenQL gate can be
+ * constructed.
+ *
+ * \throws UnknownGateException if the DQCsim gate was not recognized.
+ */
+OpenQLGateDescription OpenQLGateMap::detect(const dqcs::Gate &gate) {
+
+  // Look for the gate in the detection cache. If it's in there, we only
+  // need to fill in the qubits.
+  if (detect_cache_capacity) {
+    fingerprint(gate, detect_fingerprint);
+    auto iter = detect_cache.find(detect_fingerprint);
+    if (iter != detect_cache.end()) {
+      detect_cache_hits++;
+      operands(gate, detect_operands);
+      OpenQLGateDescription desc = iter->second.desc;
+      desc.qubits.reserve(iter->second.operand_indices.size());
+      for (size_t index : iter->second.operand_indices) {
+        desc.qubits.push_back(detect_operands[index]);
+      }
+      return desc;
+    }
+    detect_cache_misses++;
+  }
+
+  // Detect using the index if possible, and using the gate map otherwise.
+  OpenQLGateDescription desc;
+  if (detect_indexed(gate, desc)) {
+    detect_index_hits++;
+  } else {
+    detect_index_fallbacks++;
+    const size_t *id;
+    dqcs::QubitSet qubits = dqcs::QubitSet(0);
+    dqcs::ArbData params = dqcs::ArbData(0);
+    bool detected = map.detect(gate, &id, &qubits, &params);
+    if (!detected) {
+      DQCSIM_DEBUG("Gate detection failed! Dump: %s", gate.dump().c_str());
+      throw UnknownGateException("failed to convert an incoming gate to its OpenQL representation");
+    }
+    convert_detected(*id, std::move(qubits), params, desc);
+  }
+
+  // Save the result in the detection cache. We store where the detected
+  // qubits came from in the gate's operand list rather than the qubits
+  // themselves, so the entry can be reused for any set of qubits.
+  if (detect_cache_capacity) {
+    DetectCacheEntry entry;
+    entry.desc.id = desc.id;
+    entry.desc.angle = desc.angle;
+    entry.desc.multi_qubit_parallel = desc.multi_qubit_parallel;
+    operands(gate, detect_operands);
+    for (size_t qubit : desc.qubits) {
+      auto it = std::find(detect_operands.begin(), detect_operands.end(), qubit);
+      if (it == detect_operands.end()) {
+        return desc;
+      }
+      entry.operand_indices.push_back(it - detect_operands.begin());
+    }
+    if (detect_cache.size() >= detect_cache_capacity) {
+      detect_cache.clear();
+      detect_cache_clears++;
+    }
+    detect_cache.emplace(detect_fingerprint, std::move(entry));
   }
 
   return desc;
@@ -300,9 +700,50 @@ OpenQLGateDescription OpenQLGateMap::detect(const dqcs::Gate &gate) {
  */
 dqcs::Gate OpenQLGateMap::construct(const OpenQLGateDescription &desc) {
 
+  // Construct the gate from its template if possible. Then we only have to
+  // attach the qubits.
+  const OpenQLGateInfo &info = gates[desc.id];
+  const GateTemplate *tmpl = get_template(desc);
+  if (tmpl != nullptr) {
+    switch (tmpl->type) {
+      case dqcs::GateType::Unitary:
+        if (desc.qubits.size() == info.num_controls + info.num_targets) {
+          dqcs::QubitSet controls;
+          dqcs::QubitSet targets;
+          for (size_t i = 0; i < desc.qubits.size(); i++) {
+            if (i < info.num_controls) {
+              controls.push(dqcs::QubitRef(desc.qubits[i]));
+            } else {
+              targets.push(dqcs::QubitRef(desc.qubits[i]));
+            }
+          }
+          if (info.num_controls) {
+            return dqcs::Gate::unitary(std::move(targets), std::move(controls), tmpl->matrix);
+          }
+          return dqcs::Gate::unitary(std::move(targets), tmpl->matrix);
+        }
+        break;
+      case dqcs::GateType::Measurement:
+      case dqcs::GateType::Prep:
+        if (!desc.qubits.empty()) {
+          dqcs::QubitSet qubits;
+          for (size_t index : desc.qubits) {
+            qubits.push(dqcs::QubitRef(index));
+          }
+          if (tmpl->type == dqcs::GateType::Measurement) {
+            return dqcs::Gate::measure(std::move(qubits), tmpl->matrix);
+          }
+          return dqcs::Gate::prep(std::move(qubits), tmpl->matrix);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
   // Construct the parameterization object.
   dqcs::ArbData params;
-  if (has_angle.count(desc.name)) {
+  if (info.has_angle) {
     params.push_arb_arg(desc.angle);
   }
 
@@ -314,8 +755,9 @@ dqcs::Gate OpenQLGateMap::construct(const OpenQLGateDescription &desc) {
 
   // Construct the gate.
   try {
-    return map.construct(desc.name, std::move(qubits), std::move(params));
+    return map.construct(desc.id, std::move(qubits), std::move(params));
   } catch (const std::exception &e) {
-    throw UnknownGateException("failed to convert OpenQL gate " + desc.name + ": " + e.what());
+    throw UnknownGateException(
+      "failed to convert OpenQL gate " + gates[desc.id].name + ": " + e.what());
   }
 }
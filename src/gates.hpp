@@ -1,9 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
-#include <unordered_set>
+#include <unordered_map>
 #include <fstream>
 #include <json.h>
 #include <dqcsim>
+#include "unitary_index.hpp"
 
 /**
  * Used for reporting that a gate is unknown.
@@ -21,16 +26,120 @@ public:
 };
 
 /**
- * Wrapper for OpenQL gates, used by the gate map.
+ * Wrapper for OpenQL gates, used by the gate map. The gate itself is
+ * identified by its ID in the gate map, to avoid handling strings for every
+ * gate; use `OpenQLGateMap::get_name()` to get its OpenQL name.
  */
 class OpenQLGateDescription {
 public:
-  std::string name;
+  size_t id;
   std::vector<size_t> qubits;
   double angle;
   bool multi_qubit_parallel;
 };
 
+/**
+ * Information about an OpenQL gate known to the gate map, precomputed such
+ * that it can be queried by gate ID.
+ */
+class OpenQLGateInfo {
+public:
+
+  /**
+   * The OpenQL name of the gate.
+   */
+  std::string name;
+
+  /**
+   * Whether the gate uses the angle argument.
+   */
+  bool has_angle = false;
+
+  /**
+   * Whether the DQCsim equivalent of the gate having multiple target qubits
+   * means doing multiple gates in parallel (measurements and preps).
+   */
+  bool multi_qubit_parallel = false;
+
+  /**
+   * Whether the gate is a swap gate.
+   */
+  bool swap = false;
+
+  /**
+   * Whether the gate is a measurement gate.
+   */
+  bool measure = false;
+
+  /**
+   * Number of control and target qubits of the gate. For gates that are
+   * multi-qubit-parallel, this is the number of qubits of a single gate.
+   */
+  size_t num_controls = 0;
+  size_t num_targets = 0;
+
+};
+
+/**
+ * Parsed and validated gatemap entry, from which the DQCsim gatemap entry
+ * and the gate information can be built without going through JSON again.
+ */
+class OpenQLGateSpec {
+public:
+
+  /**
+   * The kind of DQCsim gate the OpenQL gate maps to.
+   */
+  enum class Kind : uint8_t {
+
+    // Measurement in the basis given by the matrix.
+    Measure,
+
+    // Prep in the basis given by the matrix.
+    Prep,
+
+    // Custom unitary given by the matrix.
+    Unitary,
+
+    // Predefined DQCsim gate.
+    Predefined
+
+  };
+
+  /**
+   * The OpenQL name of the gate.
+   */
+  std::string name;
+
+  /**
+   * The kind of DQCsim gate.
+   */
+  Kind kind = Kind::Unitary;
+
+  /**
+   * Whether the gate uses the angle argument.
+   */
+  bool has_angle = false;
+
+  /**
+   * The predefined gate, for Kind::Predefined.
+   */
+  dqcsim::wrap::PredefinedGate predefined = dqcsim::wrap::PredefinedGate::I;
+
+  /**
+   * Number of control qubits, for Kind::Unitary and Kind::Predefined.
+   */
+  size_t controlled = 0;
+
+  /**
+   * Number of qubits of the matrix, and its normalized entries in row-major
+   * order, for all kinds but Kind::Predefined.
+   */
+  size_t matrix_qubits = 0;
+  std::vector<dqcsim::wrap::complex> matrix;
+
+};
+
 /**
  * Gate map from DQCsim gates (based on matrices) to OpenQL-like gates (based
  * on identifiers) and back, based on a json description of the mapping.
@@ -39,55 +148,266 @@ class OpenQLGateMap {
 private:
 
   /**
-   * The DQCsim gatemap.
+   * The DQCsim gatemap, keyed by gate ID.
+   */
+  dqcsim::wrap::GateMap<size_t> map;
+
+  /**
+   * Information about each OpenQL gate, indexed by gate ID.
+   */
+  std::vector<OpenQLGateInfo> gates;
+
+  /**
+   * Map from OpenQL gate name to gate ID.
+   */
+  std::unordered_map<std::string, size_t> ids;
+
+  /**
+   * The parsed gatemap entries, indexed by gate ID.
+   */
+  std::vector<OpenQLGateSpec> specs;
+
+  /**
+   * Matrix detection accuracy.
+   */
+  double epsilon;
+
+  /**
+   * Everything needed to construct a DQCsim gate for some OpenQL gate, except
+   * for the qubits.
+   */
+  class GateTemplate {
+  public:
+
+    /**
+     * The type of gate; unitary, measurement, or prep.
+     */
+    dqcsim::wrap::GateType type;
+
+    /**
+     * The matrix of the gate.
+     */
+    dqcsim::wrap::Matrix matrix;
+
+  };
+
+  /**
+   * Hash function for the keys of the template cache.
+   */
+  class TemplateKeyHash {
+  public:
+    size_t operator()(const std::pair<size_t, uint64_t> &key) const {
+      return std::hash<uint64_t>()(key.second) * 31 + key.first;
+    }
+  };
+
+  /**
+   * Templates for the non-parameterized gates, indexed by gate ID. Null for
+   * parameterized gates and for gates that can't be represented by a
+   * template.
+   */
+  std::vector<std::unique_ptr<GateTemplate>> templates;
+
+  /**
+   * Templates for parameterized gates, keyed by gate ID and the exact bits
+   * of the angle. Null for gates that can't be represented by a template.
+   */
+  std::unordered_map<
+    std::pair<size_t, uint64_t>,
+    std::unique_ptr<GateTemplate>,
+    TemplateKeyHash
+  > template_cache;
+
+  /**
+   * Maximum number of entries in the template cache. When the cache is full,
+   * it is cleared.
+   */
+  size_t template_cache_capacity = 4096;
+
+  /**
+   * Cached result of a previous gate detection.
+   */
+  class DetectCacheEntry {
+  public:
+
+    /**
+     * The detected gate, without qubits.
+     */
+    OpenQLGateDescription desc;
+
+    /**
+     * For each qubit of the detected gate, the index into the list of
+     * operands of the DQCsim gate, being its controls, followed by its
+     * targets, followed by its measured qubits.
+     */
+    std::vector<size_t> operand_indices;
+
+  };
+
+  /**
+   * Detection cache, keyed by an exact fingerprint of the DQCsim gate without
+   * its qubits. See fingerprint().
    */
-  dqcsim::wrap::GateMap<std::string> map;
+  std::unordered_map<std::string, DetectCacheEntry> detect_cache;
 
   /**
-   * Stores which OpenQL gates use the angle argument.
+   * Scratch space for the detection cache key and the operands of the gate
+   * being detected, kept around to reuse their capacity.
    */
-  std::unordered_set<std::string> has_angle;
+  std::string detect_fingerprint;
+  std::vector<size_t> detect_operands;
 
   /**
-   * Stores which OpenQL gates have a DQCsim equivalent where having multiple
-   * target qubits means doing multiple gates in parallel (masurements and
-   * preps).
+   * Maximum number of entries in the detection cache. Zero disables the
+   * cache.
    */
-  std::unordered_set<std::string> is_multi_qubit_parallel;
+  size_t detect_cache_capacity = 16384;
 
   /**
-   * Constructs the gate map.
+   * Index over the unitary gates, used to detect gates that miss the
+   * detection cache without trying every DQCsim gatemap entry in turn.
    */
-  void initialize(const nlohmann::json &json, double epsilon);
+  UnitaryIndex index;
 
   /**
-   * Adds a mapping to the DQCsim gate map.
+   * Single-entry DQCsim gatemaps for the entries that are guards in the
+   * index, indexed by gate ID. Null for other entries.
    */
-  void add_mapping(
+  std::vector<std::unique_ptr<dqcsim::wrap::GateMap<size_t>>> guard_maps;
+
+  /**
+   * Constructs the gate map from its JSON description.
+   */
+  void initialize(const nlohmann::json &json);
+
+  /**
+   * Constructs the gate map from the parsed entries in specs.
+   */
+  void initialize_specs();
+
+  /**
+   * Builds the index over the unitary gates and the gatemaps for its guards.
+   */
+  void build_index();
+
+  /**
+   * Converts the result of DQCsim gate detection to a gate description.
+   */
+  void convert_detected(
+    size_t id,
+    dqcsim::wrap::QubitSet &&qubits,
+    dqcsim::wrap::ArbData &params,
+    OpenQLGateDescription &desc) const;
+
+  /**
+   * Tries to detect the given gate using the index. Returns false if the
+   * index can't tell, in which case the DQCsim gatemap must be used.
+   */
+  bool detect_indexed(const dqcsim::wrap::Gate &gate, OpenQLGateDescription &desc);
+
+  /**
+   * Returns the ID for the given OpenQL gate name, assigning a new one if it
+   * doesn't have one yet.
+   */
+  size_t intern(const std::string &openql);
+
+  /**
+   * Builds the template for constructing the given gate with the given
+   * angle. Returns null if the gate can't be represented by a template.
+   */
+  std::unique_ptr<GateTemplate> build_template(size_t id, double angle);
+
+  /**
+   * Returns the template for constructing the given gate, building it if
+   * needed, or null if the gate has no template.
+   */
+  const GateTemplate *get_template(const OpenQLGateDescription &desc);
+
+  /**
+   * Parses and validates a JSON gatemap entry.
+   */
+  static OpenQLGateSpec parse_mapping(
     const std::string &openql,
-    const nlohmann::json &desc,
-    double epsilon);
+    const nlohmann::json &desc);
+
+  /**
+   * Adds a parsed mapping to the DQCsim gate map.
+   */
+  void add_mapping(const OpenQLGateSpec &spec);
 
 public:
 
+  /**
+   * Number of gates detected using the detection cache.
+   */
+  size_t detect_cache_hits = 0;
+
+  /**
+   * Number of gates detected without using the detection cache.
+   */
+  size_t detect_cache_misses = 0;
+
+  /**
+   * Number of times the detection cache was cleared because it was full.
+   */
+  size_t detect_cache_clears = 0;
+
+  /**
+   * Number of gates missing the detection cache that were detected using the
+   * index.
+   */
+  size_t detect_index_hits = 0;
+
+  /**
+   * Number of gates missing the detection cache that had to be detected
+   * using the DQCsim gatemap.
+   */
+  size_t detect_index_fallbacks = 0;
+
+  /**
+   * Number of parameterized gates constructed using a cached template.
+   */
+  size_t template_cache_hits = 0;
+
+  /**
+   * Number of parameterized gates for which a template had to be built.
+   */
+  size_t template_cache_misses = 0;
+
+  /**
+   * Number of times the template cache was cleared because it was full.
+   */
+  size_t template_cache_clears = 0;
+
   OpenQLGateMap() = delete;
 
   /**
    * Constructs a gate map with the given JSON file and matrix detection
    * accuracy.
    */
-  OpenQLGateMap(const nlohmann::json &json, double epsilon) {
-    initialize(json, epsilon);
+  OpenQLGateMap(const nlohmann::json &json, double epsilon) : epsilon(epsilon), index(epsilon) {
+    initialize(json);
   }
 
   /**
    * Constructs a gate map with the given JSON file and matrix detection
    * accuracy.
    */
-  OpenQLGateMap(const std::string &json_fname, double epsilon) {
+  OpenQLGateMap(const std::string &json_fname, double epsilon) : epsilon(epsilon), index(epsilon) {
     std::ifstream ifs(json_fname);
     auto json = nlohmann::json::parse(ifs);
-    initialize(json, epsilon);
+    initialize(json);
+  }
+
+  /**
+   * Constructs a gate map from previously parsed entries, as returned by
+   * get_specs(), and the given matrix detection accuracy. The entries must
+   * be in gate ID order.
+   */
+  OpenQLGateMap(std::vector<OpenQLGateSpec> &&specs, double epsilon)
+    : specs(std::move(specs)), epsilon(epsilon), index(epsilon)
+  {
+    initialize_specs();
   }
 
   /**
@@ -98,6 +418,74 @@ public:
    */
   OpenQLGateDescription detect(const dqcsim::wrap::Gate &gate);
 
+  /**
+   * Returns the ID of the OpenQL gate with the given name.
+   *
+   * \throws UnknownGateException if the OpenQL gate was not recognized.
+   */
+  size_t get_id(const std::string &name) const;
+
+  /**
+   * Returns the number of OpenQL gates in the gate map. Gate IDs range from
+   * zero to this number.
+   */
+  size_t size() const {
+    return gates.size();
+  }
+
+  /**
+   * Returns the information for the OpenQL gate with the given ID.
+   */
+  const OpenQLGateInfo &get_info(size_t id) const {
+    return gates[id];
+  }
+
+  /**
+   * Returns the parsed gatemap entries, indexed by gate ID.
+   */
+  const std::vector<OpenQLGateSpec> &get_specs() const {
+    return specs;
+  }
+
+  /**
+   * Returns the matrix detection accuracy.
+   */
+  double get_epsilon() const {
+    return epsilon;
+  }
+
+  /**
+   * Returns the OpenQL name of the gate with the given ID.
+   */
+  const std::string &get_name(size_t id) const {
+    return gates[id].name;
+  }
+
+  /**
+   * Returns whether the OpenQL gate with the given ID is a swap gate.
+   */
+  bool is_swap(size_t id) const {
+    return gates[id].swap;
+  }
+
+  /**
+   * Returns whether the OpenQL gate with the given ID is a measurement gate.
+   */
+  bool is_measure(size_t id) const {
+    return gates[id].measure;
+  }
+
+  /**
+   * Sets the maximum number of entries in the detection cache. When the cache
+   * is full, it is cleared. Zero disables the cache.
+   */
+  void set_detect_cache_capacity(size_t capacity) {
+    detect_cache_capacity = capacity;
+    if (detect_cache.size() > capacity) {
+      detect_cache.clear();
+    }
+  }
+
   /**
    * Converts an OpenQL gate description to a DQCsim gate.
    *
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "gates.hpp"
+
+/**
+ * Cache for the results of mapping measurement-delimited kernels.
+ *
+ * Frontends running loops tend to send the exact same kernel body over and
+ * over again, each time delimited by the same measurements. Mapping is by far
+ * the most expensive thing this operator does, so instead of invoking OpenQL
+ * each time, we remember the mapped gate list and the resulting
+ * virtual-to-physical permutation for the most recently used kernels.
+ *
+ * Keys are opaque byte strings, built using the append_*() functions. They
+ * should contain everything that the mapping result depends on; that is, the
+ * gate sequence (gate IDs, operands, and angles) and the qubit placement at the
+ * start of the kernel. The key is compared exactly, so there are no false
+ * positives.
+ *
+ * When the cache is full, the least recently used entry is evicted. A
+ * capacity of zero disables the cache.
+ */
+class KernelCache {
+public:
+
+  /**
+   * Cached mapping result.
+   */
+  class Entry {
+  public:
+
+    /**
+     * The mapped gates, using physical qubit indices.
+     */
+    std::vector<OpenQLGateDescription> gates;
+
+    /**
+     * The virtual to physical placement that the gates assume at the start
+     * of the kernel, indexed by virtual qubit, if the kernel was given an
+     * initial placement. Empty if the placement in the key was used.
+     */
+    std::vector<size_t> v2r_in;
+
+    /**
+     * The virtual to physical placement at the end of the kernel, indexed by
+     * virtual qubit.
+     */
+    std::vector<size_t> v2r_out;
+
+  };
+
+private:
+
+  /**
+   * Key-value pairs, ordered from most to least recently used.
+   */
+  std::list<std::pair<std::string, Entry>> entries;
+
+  /**
+   * Map from key to the respective list entry.
+   */
+  std::unordered_map<std::string, std::list<std::pair<std::string, Entry>>::iterator> index;
+
+  /**
+   * Maximum number of entries.
+   */
+  size_t capacity;
+
+public:
+
+  /**
+   * Number of lookups that returned a cached result.
+   */
+  size_t hits = 0;
+
+  /**
+   * Number of lookups that did not return a cached result.
+   */
+  size_t misses = 0;
+
+  /**
+   * Number of entries evicted to make room for new ones.
+   */
+  size_t evictions = 0;
+
+  /**
+   * Constructs a kernel cache with the given maximum number of entries.
+   */
+  KernelCache(size_t capacity = 0) : capacity(capacity) {
+  }
+
+  /**
+   * Returns whether the cache is enabled.
+   */
+  bool enabled() const {
+    return capacity > 0;
+  }
+
+  /**
+   * Changes the maximum number of entries, evicting entries as needed.
+   */
+  void set_capacity(size_t new_capacity) {
+    capacity = new_capacity;
+    while (entries.size() > capacity) {
+      evict();
+    }
+  }
+
+  /**
+   * Returns the maximum number of entries.
+   */
+  size_t get_capacity() const {
+    return capacity;
+  }
+
+  /**
+   * Returns the number of entries currently in the cache.
+   */
+  size_t size() const {
+    return entries.size();
+  }
+
+  /**
+   * Appends an integer to a cache key.
+   */
+  static void append_index(std::string &key, size_t index) {
+    key.append(reinterpret_cast<const char*>(&index), sizeof(index));
+  }
+
+  /**
+   * Appends a gate to a cache key.
+   */
+  static void append_gate(
+    std::string &key,
+    size_t id,
+    const std::vector<size_t> &operands,
+    double angle
+  ) {
+    append_index(key, id);
+    append_index(key, operands.size());
+    for (size_t operand : operands) {
+      append_index(key, operand);
+    }
+    key.append(reinterpret_cast<const char*>(&angle), sizeof(angle));
+  }
+
+  /**
+   * Looks up the mapping result for the given key. Returns null if there is
+   * no such entry. The returned pointer remains valid until the next call to
+   * insert() or set_capacity().
+   */
+  const Entry *lookup(const std::string &key) {
+    if (!enabled()) {
+      return nullptr;
+    }
+    auto iter = index.find(key);
+    if (iter == index.end()) {
+      misses++;
+      return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, iter->second);
+    return &iter->second->second;
+  }
+
+  /**
+   * Inserts a mapping result into the cache, evicting the least recently used
+   * entry if the cache is full. Returns a pointer to the stored entry, which
+   * remains valid until the next call to insert() or set_capacity(). Must
+   * not be called when the cache is disabled.
+   */
+  const Entry *insert(std::string &&key, Entry &&entry) {
+    auto iter = index.find(key);
+    if (iter != index.end()) {
+      iter->second->second = std::move(entry);
+      entries.splice(entries.begin(), entries, iter->second);
+      return &iter->second->second;
+    }
+    while (entries.size() >= capacity) {
+      evict();
+    }
+    entries.emplace_front(std::move(key), std::move(entry));
+    index.emplace(entries.front().first, entries.begin());
+    return &entries.front().second;
+  }
+
+private:
+
+  /**
+   * Evicts the least recently used entry.
+   */
+  void evict() {
+    index.erase(entries.back().first);
+    entries.pop_back();
+    evictions++;
+  }
+
+};
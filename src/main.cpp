@@ -1,61 +1,56 @@
-#include <cstdlib>
-#include <string>
 #include <dqcsim>
-#include <openql.h>
-#include "bimap.hpp"
-#include "gates.hpp"
+#include "plugin.hpp"
 
 // Alias the dqcsim::wrap namespace to something shorter.
 namespace dqcs = dqcsim::wrap;
 
 /**
- * Operator plugin for the mapper.
+ * Downstream interface implementation for the DQCsim plugin state.
  */
-class MapperPlugin {
-public:
+class PluginStateDownstream : public Downstream {
+private:
+  dqcs::PluginState &state;
 
-  // OpenQL platform.
-  std::shared_ptr<ql::quantum_platform> platform;
+public:
 
-  // OpenQL mapper.
-  Mapper mapper;
+  PluginStateDownstream(dqcs::PluginState &state) : state(state) {
+  }
 
-  // Current OpenQL kernel.
-  std::shared_ptr<ql::quantum_kernel> kernel;
+  void allocate(size_t num_qubits) override {
+    TimelineScope scope("state.allocate");
+    state.allocate(num_qubits);
+  }
 
-  // Number of physical qubits in the platform.
-  size_t num_qubits;
+  void gate(dqcs::Gate &&gate) override {
+    TimelineScope scope("state.gate");
+    state.gate(std::move(gate));
+  }
 
-  // Kernel counter, for generating unique names.
-  size_t kernel_counter = 0;
+  dqcs::Measurement get_measurement(const dqcs::QubitRef &qubit) override {
+    TimelineScope scope("state.get_measurement");
+    return state.get_measurement(qubit);
+  }
 
-  // Map from DQCsim gates to OpenQL gate descriptions and back.
-  std::shared_ptr<OpenQLGateMap> gatemap;
+  dqcs::ArbData arb(dqcs::ArbCmd &&cmd) override {
+    TimelineScope scope("state.arb");
+    return state.arb(std::move(cmd));
+  }
 
-  // Map from DQCsim qubits to OpenQL qubits.
-  QubitBiMap dqcs2virt;
+  uint64_t random() override {
+    return state.random();
+  }
 
-  // Number of upstream qubits allocated so far.
-  size_t dqcs_nq = 0;
+};
 
-  // Map from OpenQL virtual qubits to OpenQL physical qubits. We need to keep
-  // track of this because the mapper entry point currently isn't stateful...
-  // and in fact can't be passed an input mapping other than one-to-one, so we
-  // have to use a few tricks to make it work. Basically, all gates are added
-  // to the kernels with the current *physical* qubit mapping to make the
-  // one-to-one "initial" mapping be correct, and after mapping this map is
-  // updated to reflect the new virtual to physical map after mapping.
-  QubitBiMap virt2phys;
+/**
+ * DQCsim callbacks for the mapper operator. These just convert between
+ * DQCsim's interface and MapperPlugin's.
+ */
+class MapperOperator {
+public:
 
-  /**
-   * Constructs a new kernel, representing a new measurement-delimited block.
-   */
-  void new_kernel() {
-    kernel = std::make_shared<ql::quantum_kernel>(
-      "kernel_" + std::to_string(kernel_counter),
-      *platform, num_qubits);
-    kernel_counter++;
-  }
+  // The operator logic.
+  MapperPlugin plugin;
 
   /**
    * Initialization callback.
@@ -65,8 +60,71 @@ public:
    *
    *  - openql_mapper.hardware_config: expects a single string argument
    *    specifying the location of the JSON file describing the platform.
+   *  - openql_mapper.snapshot: expects a single string argument specifying
+   *    a snapshot file compiled with dqcsopopenql-mapper-snapshot, which is
+   *    used instead of the gatemap file.
    *  - openql_mapper.option: expects two string arguments, interpreted as key
    *    and value for `ql::options::set()`.
+   *  - openql_mapper.trial: expects zero or more key-value pairs of string
+   *    arguments, specifying OpenQL options for an additional mapper
+   *    configuration that each kernel is mapped with.
+   *  - openql_mapper.trial_metric: expects a single string argument, "swaps"
+   *    or "depth", selecting how the best mapping result is picked.
+   *  - openql_mapper.route_cache: expects a single string argument
+   *    specifying a directory to cache the platform's routing tables in.
+   *  - openql_mapper.placement_effort: expects a single string argument
+   *    specifying the maximum number of qubit exchanges evaluated for the
+   *    initial placement.
+   *  - openql_mapper.placement_budget: expects a single string argument
+   *    specifying a time limit for the initial placement in milliseconds.
+   *  - openql_mapper.kernel_cache: expects a single string argument
+   *    specifying the maximum number of mapped kernels to cache. Zero
+   *    disables the cache.
+   *  - openql_mapper.detect_cache: expects a single string argument
+   *    specifying the maximum number of distinct gates for which the gate
+   *    detection result is cached. Zero disables the cache.
+   *  - openql_mapper.fast_path: expects a single string argument, "yes" or
+   *    "no", specifying whether kernels that can be executed without routing
+   *    bypass the OpenQL mapper. Defaults to yes.
+   *  - openql_mapper.peephole: expects a single string argument, "yes" or
+   *    "no", specifying whether redundant gates are removed from each kernel
+   *    before it is mapped. Defaults to no.
+   *  - openql_mapper.swap_cancellation: expects a single string argument,
+   *    "yes" or "no", specifying whether swaps that are immediately undone
+   *    are removed from the gates sent downstream, and swaps are folded into
+   *    adjacent cnots where the platform decomposes swaps. Defaults to no.
+   *  - openql_mapper.virtual_swaps: expects a single string argument, "yes"
+   *    or "no", specifying whether swaps are performed by permuting the
+   *    downstream qubits instead of sending swap gates. Defaults to no.
+   *  - openql_mapper.coalesce: expects a single string argument, "yes" or
+   *    "no", specifying whether consecutive measurements or preps of the
+   *    same kind are sent downstream as a single gate. Defaults to yes.
+   *  - openql_mapper.window_gates: expects a single string argument
+   *    specifying the maximum number of gates queued up before they are
+   *    mapped and sent downstream without waiting for a measurement. Zero
+   *    (the default) means unlimited.
+   *  - openql_mapper.window_depth: same as window_gates, but limits the
+   *    circuit depth of the queued gates instead.
+   *  - openql_mapper.defer_measurements: expects a single string argument,
+   *    "yes" or "no", specifying whether measurements are queued up like
+   *    other gates instead of flushing the kernel. Defaults to no.
+   *  - openql_mapper.causal_flush: expects a single string argument, "yes"
+   *    or "no", specifying whether a measurement only flushes the queued
+   *    gates it depends on. Defaults to no.
+   *  - openql_mapper.stats_file: expects a single string argument
+   *    specifying a file to write the performance counters to as JSON when
+   *    the operator is dropped.
+   *  - openql_mapper.timeline_file: expects a single string argument
+   *    specifying a file to write a timeline of the plugin callbacks to in
+   *    the Chrome trace event format when the operator is dropped.
+   *  - openql_mapper.record: expects a single string argument specifying a
+   *    file to record the mapping results to.
+   *  - openql_mapper.replay: expects a single string argument specifying a
+   *    file previously written using openql_mapper.record to replay the
+   *    mapping results from.
+   *  - openql_mapper.debug_dumps: expects a single string argument, "yes" or
+   *    "no", specifying whether the qubit map and all gates should be dumped
+   *    with debug verbosity. Defaults to no.
    *
    * TODO: it'd be nice to be able to omit the JSON filenames and instead pass
    * the contents of the files through the JSON object in the arb directly.
@@ -75,97 +133,15 @@ public:
     dqcs::PluginState &state,
     dqcs::ArbCmdQueue &&cmds
   ) {
-    std::string platform_json_fname;
-    std::string gatemap_json_fname;
-
-    // Get the default values for the gate and platform JSON filenames from the
-    // environment.
-    const char *s;
-    s = std::getenv("DQCSIM_OPENQL_HARDWARE_CONFIG");
-    if (s != nullptr) platform_json_fname = std::string(s);
-    s = std::getenv("DQCSIM_OPENQL_GATEMAP");
-    if (s != nullptr) gatemap_json_fname = std::string(s);
-
-    // Interpret the initialization commands.
-    for (; cmds.size(); cmds.next()) {
-      if (cmds.is_iface("openql_mapper")) {
-        if (cmds.is_oper("hardware_config")) {
-          if (cmds.get_arb_arg_count() != 1) {
-            throw std::invalid_argument("Expected one argument for openql_mapper.hardware_config");
-          } else {
-            platform_json_fname = cmds.get_arb_arg_string(0);
-          }
-        } else if (cmds.is_oper("gatemap")) {
-          if (cmds.get_arb_arg_count() != 1) {
-            throw std::invalid_argument("Expected one argument for openql_mapper.gatemap");
-          } else {
-            gatemap_json_fname = cmds.get_arb_arg_string(0);
-          }
-        } else if (cmds.is_oper("option")) {
-          if (cmds.get_arb_arg_count() != 2) {
-            throw std::invalid_argument("Expected two arguments for openql_mapper.option");
-          } else {
-            ql::options::set(cmds.get_arb_arg_string(0), cmds.get_arb_arg_string(1));
-          }
-        } else {
-          throw std::invalid_argument("Unknown command openql_mapper." + cmds.get_oper());
-        }
-      }
-    }
-
-    // Check that we have a platform and gatemap description.
-    if (platform_json_fname.empty()) {
-      throw std::invalid_argument(
-        "Missing openql_mapper.hardware_config cmd/DQCSIM_OPENQL_HARDWARE_CONFIG env");
-    }
-    if (gatemap_json_fname.empty()) {
-      throw std::invalid_argument(
-        "Missing openql_mapper.gatemap cmd/DQCSIM_OPENQL_GATEMAP env");
-    }
-
-    // Construct the OpenQL platform.
-    platform = std::make_shared<ql::quantum_platform>("dqcsim_platform", platform_json_fname);
-    platform->print_info();
-    ql::set_platform(*platform);
-    num_qubits = platform->qubit_number;
-
-    // Construct the mapper.
-    // FIXME: this initializes its own private random generator with the
-    // current timestamp, but DQCsim plugins should be pure to be
-    // reproducible! It should be seeded with DQCsim's random number
-    // generator (`state.random()`).
-    mapper.Init(*platform);
-
-    // Construct the initial kernel.
-    new_kernel();
-
-    // Construct the DQCsim/OpenQL gatemap.
-    // TODO: the epsilon value should probably be configurable.
-    gatemap = std::make_shared<OpenQLGateMap>(gatemap_json_fname, 1.0e-6);
-
-    // Allocate the physical qubits downstream.
-    state.allocate(num_qubits);
-    DQCSIM_INFO("OpenQL platform with %d qubits loaded", num_qubits);
-
-    // Initialize the virt2phys map.
-    for (size_t qubit = 0; qubit < num_qubits; qubit++) {
-      virt2phys.map(qubit, qubit);
-    }
-
+    MapperConfig config;
+    config.load_env();
+    config.load_cmds(std::move(cmds));
+    PluginStateDownstream downstream(state);
+    plugin.initialize(downstream, config);
   }
 
   /**
    * Qubit allocation callback.
-   *
-   * DQCsim supports allocating and freeing qubits at will, but obviously a
-   * physical platform doesn't. The trivial solution would be to just error
-   * out on the N+1'th qubit allocation, but we can do better than that when
-   * there are deallocations as well by reusing qubits that were freed. That's
-   * what the dqcs2virt bimap is used for; mapping the upstream DQCsim qubit
-   * references to virtual qubits in OpenQL. When qubits aren't freed until
-   * the end of the program (or are never freed), the OpenQL virtual qubit
-   * index will just be the DQCsim index, minus one because DQCsim starts
-   * counting at one.
    */
   void allocate(
     dqcs::PluginState &state,
@@ -184,323 +160,46 @@ public:
       }
     }
 
-    // Loop over the qubits that are to be allocated.
-    while (qubits.size()) {
-
-      // A new DQCsim upstream qubit index to allocate.
-      size_t dqcsim_qubit = qubits.pop().get_index();
-
-      // Look for the first free OpenQL virtual qubit index.
-      bool found = false;
-      for (size_t virt_qubit = 0; virt_qubit < num_qubits; virt_qubit++) {
-        if (dqcs2virt.reverse_lookup(virt_qubit) < 0) {
-          DQCSIM_DEBUG("Placed upstream qubit %d at virtual index %d", dqcsim_qubit, virt_qubit);
-          dqcs2virt.map(dqcsim_qubit, virt_qubit);
-          found = true;
-          break;
-        }
-      }
-
-      // Error out if we can't find a free qubit. This means that too many
-      // qubits are currently live.
-      if (!found) {
-        throw std::runtime_error("Upstream plugin requires too many live qubits!");
-      }
-
-      // Update the qubit counter.
-      dqcs_nq++;
-
-    }
-
+    PluginStateDownstream downstream(state);
+    plugin.allocate(downstream, std::move(qubits));
   }
 
   /**
    * Qubit deallocation callback.
-   *
-   * Inverse of `allocate()`.
    */
   void free(
     dqcs::PluginState &state,
     dqcs::QubitSet &&qubits
   ) {
-
-    // Loop over the qubits that are to be freed.
-    while (qubits.size()) {
-
-      // The DQCsim upstream qubit index to free.
-      size_t dqcsim_qubit = qubits.pop().get_index();
-
-      // Unmap it in the bimap to do the free.
-      DQCSIM_DEBUG("Freed upstream qubit %d", dqcsim_qubit);
-      dqcs2virt.unmap_upstream(dqcsim_qubit);
-
-    }
-
-  }
-
-  /**
-   * Dumps the current qubit map with debug verbosity.
-   */
-  void dump_qubit_map() {
-    std::string dump;
-    char lbuf[64];
-
-    // Print table header.
-    dump += "| upstream | virtual  | physical |downstream|\n";
-    dump += "|----------|----------|----------|----------|\n";
-
-    // Print mappings for all upstream qubits.
-    std::unordered_set<size_t> phys_printed;
-    for (size_t dqcs = 1; dqcs <= dqcs_nq; dqcs++) {
-      std::string dqcs_str = std::to_string(dqcs);
-      std::string virt_str = "-";
-      std::string phys_str = "-";
-      std::string down_str = "-";
-
-      ssize_t virt = dqcs2virt.forward_lookup(dqcs);
-      if (virt >= 0) {
-        virt_str = std::to_string(virt);
-        ssize_t phys = virt2phys.forward_lookup(virt);
-        if (phys >= 0) {
-          phys_printed.insert(phys);
-          phys_str = std::to_string(phys);
-          down_str = std::to_string(phys + 1);
-        }
-      }
-
-      snprintf(
-        lbuf, sizeof(lbuf), "| %8s | %8s | %8s | %8s |\n",
-        dqcs_str.c_str(), virt_str.c_str(), phys_str.c_str(), down_str.c_str());
-      dump += lbuf;
-    }
-
-    // Print mappings for any remaining physical qubits.
-    for (size_t phys = 0; phys < num_qubits; phys++) {
-      if (phys_printed.count(phys)) {
-        continue;
-      }
-      std::string dqcs_str = "-";
-      std::string virt_str = "-";
-      std::string phys_str = std::to_string(phys);
-      std::string down_str = std::to_string(phys + 1);
-
-      ssize_t virt = virt2phys.reverse_lookup(phys);
-      if (virt >= 0) {
-        virt_str = std::to_string(virt);
-      }
-
-      snprintf(
-        lbuf, sizeof(lbuf), "| %8s | %8s | %8s | %8s |\n",
-        dqcs_str.c_str(), virt_str.c_str(), phys_str.c_str(), down_str.c_str());
-      dump += lbuf;
-    }
-
-    DQCSIM_DEBUG("Current qubit mapping:\n%s", dump.c_str());
-  }
-
-  /**
-   * Dumps a gate with debug verbosity.
-   */
-  static void dump_gate(
-    const std::string &prefix,
-    const std::string &qubit_type,
-    const OpenQLGateDescription &desc
-  ) {
-    std::string qubits_string;
-    for (size_t qubit : desc.qubits) {
-      if (!qubits_string.empty()) {
-        qubits_string += ", ";
-      }
-      qubits_string += std::to_string(qubit);
-    }
-    DQCSIM_DEBUG(
-      "%s gate %s with %s qubit(s) %s and angle %f",
-      prefix.c_str(), desc.name.c_str(), qubit_type.c_str(),
-      qubits_string.c_str(), desc.angle);
-  }
-
-  /**
-   * This function runs the mapper for the gates queued up thus far, sends the
-   * mapped gates downstream, and returns the measurement result of the last
-   * gate if it's a measurement gate.
-   */
-  void run_mapper(
-    dqcs::PluginState &state
-  ) {
-
-    // If the current kernel is empty, we don't have to do anything.
-    if (kernel->c.empty()) {
-      return;
-    }
-
-    // If this is the first kernel being mapped, assume that the initial
-    // virtual to physical mapping doesn't matter, so we can do an initial map.
-    // If this isn't the first, assume the mapping is one-to-one; we've been
-    // building the kernel with physical qubit indices to make this valid.
-    if (kernel_counter == 0) {
-      ql::options::set("mapinitone2one", "no");
-      // It's up to the user whether we do initial placement here. The default
-      // is currently defined to no in OpenQL.
-    } else {
-      ql::options::set("mapinitone2one", "yes");
-      ql::options::set("initialplace", "no");
-    }
-
-    // Don't insert prep gates automatically; let the upstream plugin handle
-    // that. DQCsim currently doesn't really support prep gates anyway (they're
-    // implemented as a measurement followed by a conditional X).
-    ql::options::set("mapassumezeroinitstate", "yes");
-
-    // Dump the current qubit map.
-    dump_qubit_map();
-
-    // Run the mapper on the kernel.
-    mapper.Map(*kernel);
-
-    // Update our copy of the virtual to physical map based on the mapping
-    // result.
-    QubitBiMap new_virt2phys;
-    for (size_t old_phys = 0; old_phys < num_qubits; old_phys++) {
-      size_t new_phys = mapper.v2r_out[old_phys];
-      if (new_phys != UNDEFINED_QUBIT) {
-        ssize_t virt = virt2phys.reverse_lookup(old_phys);
-        if (virt >= 0) {
-          new_virt2phys.map(virt, new_phys);
-        }
-      }
-    }
-    virt2phys = new_virt2phys;
-
-    // Dump the new qubit map.
-    dump_qubit_map();
-
-    // Send the gates downstream, remembering the last gate.
-    OpenQLGateDescription desc;
-    for (ql::gate *ql_gate : kernel->c) {
-
-      // Convert to DQCsim gates.
-      desc.name = ql_gate->name;
-      desc.angle = ql_gate->angle;
-      desc.qubits.clear();
-      for (size_t phys : ql_gate->operands) {
-        desc.qubits.push_back(phys + 1);
-      }
-      dump_gate("Sending", "downstream", desc);
-      state.gate(gatemap->construct(desc));
-
-    }
-
-    // Construct a new kernel for the next batch.
-    new_kernel();
-
+    PluginStateDownstream downstream(state);
+    plugin.free(downstream, std::move(qubits));
   }
 
   /**
    * Gate callback.
-   *
-   * Measurement gates must be forwarded immediately, but we can queue
-   * everything else up in the circuit.
    */
   dqcs::MeasurementSet gate(
     dqcs::PluginState &state,
     dqcs::Gate &&gate
   ) {
-
-    // Convert the DQCsim gate to its OpenQL representation.
-    OpenQLGateDescription desc = gatemap->detect(gate);
-    dump_gate("Receiving", "upstream", desc);
-
-    // The qubit indices in the vector currently use DQCsim indices. We need to
-    // convert them to the current *physical* qubit index, because the mapper
-    // maps the circuits without maintaining state (this isn't implemented yet
-    // apparently). Instead, we have it assume that the initial state is
-    // one-to-one, making physical indices the right ones here.
-    for (size_t i = 0; i < desc.qubits.size(); i++) {
-      size_t dqcs = desc.qubits[i];
-      ssize_t virt = dqcs2virt.forward_lookup(dqcs);
-      if (virt < 0) {
-        throw std::runtime_error(
-          "Missing mapping from DQCsim qubit index " + std::to_string(dqcs) + " to virtual");
-      }
-      ssize_t phys = virt2phys.forward_lookup(virt);
-      if (phys < 0) {
-        throw std::runtime_error(
-          "Missing mapping from virtual qubit index " + std::to_string(virt) + " to physical");
-      }
-      desc.qubits[i] = phys;
-    }
-
-    // Add the gate to the current kernel.
-    if (desc.multi_qubit_parallel) {
-      std::vector<size_t> qubits;
-      for (size_t qubit : desc.qubits) {
-        qubits.push_back(qubit);
-        kernel->gate(desc.name, qubits, {}, 0, desc.angle);
-        qubits.clear();
-      }
-    } else {
-      kernel->gate(desc.name, desc.qubits, {}, 0, desc.angle);
-    }
-
-    // If the gate was a measurement gate, run the mapper now. If we try to
-    // queue up the measurement, we might get a deadlock, because the frontend
-    // may end up needing the measurement result to determine what the next
-    // gate will be.
-    if (gate.has_measures()) {
-      run_mapper(state);
-    }
-
-    // Return the measurements requested by this gates.
-    dqcs::MeasurementSet measurements = dqcs::MeasurementSet();
-    if (gate.has_measures()) {
-      dqcs::QubitSet measures = gate.get_measures();
-      while (measures.size()) {
-
-        // Get the upstream qubit reference.
-        dqcs::QubitRef up_ref = measures.pop();
-
-        // Convert from upstream qubit index to downstream.
-        size_t dqcs = up_ref.get_index();
-        ssize_t virt = dqcs2virt.forward_lookup(dqcs);
-        if (virt < 0) {
-          throw std::runtime_error(
-            "Missing mapping from DQCsim qubit index " + std::to_string(dqcs) + " to virtual");
-        }
-        ssize_t phys = virt2phys.forward_lookup(virt);
-        if (phys < 0) {
-          throw std::runtime_error(
-            "Missing mapping from virtual qubit index " + std::to_string(virt) + " to physical");
-        }
-        size_t down = phys + 1;
-
-        // Get the downstream qubit reference.
-        dqcs::QubitRef down_ref = dqcs::QubitRef(down);
-
-        // Get, convert, and save the measurement result.
-        dqcs::Measurement meas = state.get_measurement(down_ref);
-        meas.set_qubit(up_ref);
-        measurements.set(std::move(meas));
-
-      }
-    }
-
-    return measurements;
+    PluginStateDownstream downstream(state);
+    return plugin.gate(downstream, std::move(gate));
   }
 
   /**
    * Modify-measurement callback.
    *
    * This is called when measurement data is received from the downstream
-   * plugin and is to be sent upstream implicitly. We do everything explicitly
-   * in gate() though, so we never have to return anything here. We have to
-   * override it though, because the default behavior for the
+   * plugin and is to be sent upstream implicitly. Normally we do everything
+   * explicitly in gate(), but deferred measurements are returned here. We
+   * have to override it either way, because the default behavior for the
    * modify-measurement callback is to pass the results through unchanged.
    */
   dqcs::MeasurementSet modify_measurement(
     dqcs::UpstreamPluginState &state,
     dqcs::Measurement &&measurement
   ) {
-    return dqcs::MeasurementSet();
+    return plugin.modify_measurement(std::move(measurement));
   }
 
   /**
@@ -522,6 +221,36 @@ public:
     }
   }
 
+  /**
+   * Host ArbCmd callback.
+   */
+  dqcs::ArbData host_arb(
+    dqcs::PluginState &state,
+    dqcs::ArbCmd &&cmd
+  ) {
+    if (cmd.is_iface("openql_mapper")) {
+      PluginStateDownstream downstream(state);
+      return plugin.handle_arb(downstream, std::move(cmd));
+    }
+    return dqcs::ArbData();
+  }
+
+  /**
+   * Upstream ArbCmd callback. Commands not addressed to this operator are
+   * forwarded downstream, like the default implementation does, after
+   * sending any gates the operator is still holding back.
+   */
+  dqcs::ArbData upstream_arb(
+    dqcs::PluginState &state,
+    dqcs::ArbCmd &&cmd
+  ) {
+    PluginStateDownstream downstream(state);
+    if (cmd.is_iface("openql_mapper")) {
+      return plugin.handle_arb(downstream, std::move(cmd));
+    }
+    return plugin.forward_arb(downstream, std::move(cmd));
+  }
+
   /**
    * Drop callback.
    *
@@ -531,20 +260,23 @@ public:
   void drop(
     dqcs::PluginState &state
   ) {
-    run_mapper(state);
+    PluginStateDownstream downstream(state);
+    plugin.drop(downstream);
   }
 
 };
 
 int main(int argc, char *argv[]) {
-  MapperPlugin mapperPlugin;
+  MapperOperator mapperOperator;
   return dqcs::Plugin::Operator("openql_mapper", "JvS", "0.0.3")
-    .with_initialize(&mapperPlugin, &MapperPlugin::initialize)
-    .with_allocate(&mapperPlugin, &MapperPlugin::allocate)
-    .with_free(&mapperPlugin, &MapperPlugin::free)
-    .with_gate(&mapperPlugin, &MapperPlugin::gate)
-    .with_modify_measurement(&mapperPlugin, &MapperPlugin::modify_measurement)
-    .with_advance(&mapperPlugin, &MapperPlugin::advance)
-    .with_drop(&mapperPlugin, &MapperPlugin::drop)
+    .with_initialize(&mapperOperator, &MapperOperator::initialize)
+    .with_allocate(&mapperOperator, &MapperOperator::allocate)
+    .with_free(&mapperOperator, &MapperOperator::free)
+    .with_gate(&mapperOperator, &MapperOperator::gate)
+    .with_modify_measurement(&mapperOperator, &MapperOperator::modify_measurement)
+    .with_advance(&mapperOperator, &MapperOperator::advance)
+    .with_host_arb(&mapperOperator, &MapperOperator::host_arb)
+    .with_upstream_arb(&mapperOperator, &MapperOperator::upstream_arb)
+    .with_drop(&mapperOperator, &MapperOperator::drop)
     .run(argc, argv);
 }
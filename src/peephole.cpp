@@ -0,0 +1,355 @@
+#include <cmath>
+#include <complex>
+#include <unordered_set>
+#include <peephole.hpp>
+
+// Alias the dqcsim::wrap namespace to something shorter.
+namespace dqcs = dqcsim::wrap;
+
+// Marker for a missing gate ID.
+static const size_t NO_GATE = (size_t)-1;
+
+/**
+ * Returns the predefined gate that is the exact inverse of the given one, if
+ * there is such a gate and the inverse doesn't need an angle. Otherwise,
+ * returns false.
+ */
+static bool predefined_inverse(dqcs::PredefinedGate gate, dqcs::PredefinedGate &inverse) {
+  switch (gate) {
+    case dqcs::PredefinedGate::X:
+    case dqcs::PredefinedGate::Y:
+    case dqcs::PredefinedGate::Z:
+    case dqcs::PredefinedGate::H:
+    case dqcs::PredefinedGate::Swap:
+      inverse = gate;
+      return true;
+    case dqcs::PredefinedGate::S: inverse = dqcs::PredefinedGate::S_DAG; return true;
+    case dqcs::PredefinedGate::S_DAG: inverse = dqcs::PredefinedGate::S; return true;
+    case dqcs::PredefinedGate::T: inverse = dqcs::PredefinedGate::T_DAG; return true;
+    case dqcs::PredefinedGate::T_DAG: inverse = dqcs::PredefinedGate::T; return true;
+    case dqcs::PredefinedGate::RX_90: inverse = dqcs::PredefinedGate::RX_M90; return true;
+    case dqcs::PredefinedGate::RX_M90: inverse = dqcs::PredefinedGate::RX_90; return true;
+    case dqcs::PredefinedGate::RY_90: inverse = dqcs::PredefinedGate::RY_M90; return true;
+    case dqcs::PredefinedGate::RY_M90: inverse = dqcs::PredefinedGate::RY_90; return true;
+    case dqcs::PredefinedGate::RZ_90: inverse = dqcs::PredefinedGate::RZ_M90; return true;
+    case dqcs::PredefinedGate::RZ_M90: inverse = dqcs::PredefinedGate::RZ_90; return true;
+    default: return false;
+  }
+}
+
+/**
+ * Returns whether matrices a and b are equal within the given accuracy,
+ * optionally ignoring global phase.
+ */
+static bool approx_equal(
+  const std::vector<dqcs::complex> &a,
+  const std::vector<dqcs::complex> &b,
+  bool ignore_phase,
+  double epsilon
+) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+
+  // Find the global phase difference from the largest entry of b.
+  dqcs::complex phase = 1.0;
+  if (ignore_phase) {
+    size_t largest = 0;
+    for (size_t i = 1; i < b.size(); i++) {
+      if (std::abs(b[i]) > std::abs(b[largest])) {
+        largest = i;
+      }
+    }
+    if (std::abs(a[largest]) < epsilon) {
+      return false;
+    }
+    phase = a[largest] / b[largest];
+    phase /= std::abs(phase);
+  }
+
+  for (size_t i = 0; i < a.size(); i++) {
+    if (std::abs(a[i] - phase * b[i]) > epsilon) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Prepares the optimizer for the gates in the given gatemap. Gates for which
+ * the given OpenQL instruction settings (the "instructions" section of the
+ * hardware configuration) set disable_optimization are left alone.
+ */
+Peephole::Peephole(
+  const OpenQLGateMap &gatemap,
+  const nlohmann::json &instruction_settings
+) : epsilon(gatemap.get_epsilon()) {
+  for (size_t &rotation : rotations) {
+    rotation = NO_GATE;
+  }
+
+  // Gather the names of the gates that must not be optimized. OpenQL
+  // instruction names may be specialized for particular qubits, as in
+  // "x q0", in which case we conservatively leave all x gates alone.
+  std::unordered_set<std::string> disabled;
+  if (instruction_settings.is_object()) {
+    for (auto it = instruction_settings.begin(); it != instruction_settings.end(); it++) {
+      if (!it.value().is_object()) {
+        continue;
+      }
+      auto flag = it.value().find("disable_optimization");
+      if (flag != it.value().end() && flag->is_boolean() && flag->get<bool>()) {
+        disabled.insert(it.key().substr(0, it.key().find(' ')));
+      }
+    }
+  }
+
+  // Build the rules for each gate.
+  const std::vector<OpenQLGateSpec> &specs = gatemap.get_specs();
+  rules.resize(specs.size());
+  for (size_t id = 0; id < specs.size(); id++) {
+    const OpenQLGateSpec &spec = specs[id];
+    Rule &rule = rules[id];
+    if (disabled.count(spec.name)) {
+      DQCSIM_DEBUG("Peephole optimization disabled for %s", spec.name.c_str());
+      continue;
+    }
+    if (spec.kind == OpenQLGateSpec::Kind::Measure || spec.kind == OpenQLGateSpec::Kind::Prep) {
+      continue;
+    }
+    rule.enabled = true;
+    rule.has_angle = spec.has_angle;
+
+    // Handle custom unitaries. These are only recognized as the identity or
+    // as the inverse of another custom unitary.
+    if (spec.kind == OpenQLGateSpec::Kind::Unitary) {
+      size_t dim = (size_t)1 << spec.matrix_qubits;
+      std::vector<dqcs::complex> identity(dim * dim, 0.0);
+      std::vector<dqcs::complex> adjoint(dim * dim);
+      for (size_t row = 0; row < dim; row++) {
+        identity[row * dim + row] = 1.0;
+        for (size_t col = 0; col < dim; col++) {
+          adjoint[row * dim + col] = std::conj(spec.matrix[col * dim + row]);
+        }
+      }
+      bool ignore_phase = spec.controlled == 0;
+      rule.identity = approx_equal(spec.matrix, identity, ignore_phase, epsilon);
+      for (size_t other = 0; other < specs.size(); other++) {
+        const OpenQLGateSpec &other_spec = specs[other];
+        if (other_spec.kind == OpenQLGateSpec::Kind::Unitary
+          && other_spec.controlled == spec.controlled
+          && !disabled.count(other_spec.name)
+          && approx_equal(other_spec.matrix, adjoint, ignore_phase, epsilon)
+        ) {
+          rule.inverse = other;
+          break;
+        }
+      }
+      continue;
+    }
+
+    // Handle predefined gates.
+    rule.identity = spec.predefined == dqcs::PredefinedGate::I;
+    rule.symmetric = spec.predefined == dqcs::PredefinedGate::Swap;
+    dqcs::PredefinedGate inverse;
+    if (!spec.has_angle && predefined_inverse(spec.predefined, inverse)) {
+      for (size_t other = 0; other < specs.size(); other++) {
+        const OpenQLGateSpec &other_spec = specs[other];
+        if (other_spec.kind == OpenQLGateSpec::Kind::Predefined
+          && other_spec.predefined == inverse
+          && other_spec.controlled == spec.controlled
+          && !other_spec.has_angle
+          && !disabled.count(other_spec.name)
+        ) {
+          rule.inverse = other;
+          break;
+        }
+      }
+    }
+
+    // Uncontrolled single-qubit gates that are equivalent to a rotation up to
+    // global phase can be merged.
+    if (spec.controlled) {
+      continue;
+    }
+    switch (spec.predefined) {
+      case dqcs::PredefinedGate::X: rule.axis = Axis::X; rule.angle = M_PI; break;
+      case dqcs::PredefinedGate::RX_90: rule.axis = Axis::X; rule.angle = M_PI_2; break;
+      case dqcs::PredefinedGate::RX_M90: rule.axis = Axis::X; rule.angle = -M_PI_2; break;
+      case dqcs::PredefinedGate::RX_180: rule.axis = Axis::X; rule.angle = M_PI; break;
+      case dqcs::PredefinedGate::RX: rule.axis = Axis::X; break;
+      case dqcs::PredefinedGate::Y: rule.axis = Axis::Y; rule.angle = M_PI; break;
+      case dqcs::PredefinedGate::RY_90: rule.axis = Axis::Y; rule.angle = M_PI_2; break;
+      case dqcs::PredefinedGate::RY_M90: rule.axis = Axis::Y; rule.angle = -M_PI_2; break;
+      case dqcs::PredefinedGate::RY_180: rule.axis = Axis::Y; rule.angle = M_PI; break;
+      case dqcs::PredefinedGate::RY: rule.axis = Axis::Y; break;
+      case dqcs::PredefinedGate::Z: rule.axis = Axis::Z; rule.angle = M_PI; break;
+      case dqcs::PredefinedGate::S: rule.axis = Axis::Z; rule.angle = M_PI_2; break;
+      case dqcs::PredefinedGate::S_DAG: rule.axis = Axis::Z; rule.angle = -M_PI_2; break;
+      case dqcs::PredefinedGate::T: rule.axis = Axis::Z; rule.angle = M_PI_4; break;
+      case dqcs::PredefinedGate::T_DAG: rule.axis = Axis::Z; rule.angle = -M_PI_4; break;
+      case dqcs::PredefinedGate::RZ_90: rule.axis = Axis::Z; rule.angle = M_PI_2; break;
+      case dqcs::PredefinedGate::RZ_M90: rule.axis = Axis::Z; rule.angle = -M_PI_2; break;
+      case dqcs::PredefinedGate::RZ_180: rule.axis = Axis::Z; rule.angle = M_PI; break;
+      case dqcs::PredefinedGate::RZ: rule.axis = Axis::Z; break;
+      default: break;
+    }
+    if (rule.axis == Axis::None) {
+      continue;
+    }
+    if (!spec.has_angle) {
+      fixed_rotations[(size_t)rule.axis].emplace_back(id, rule.angle);
+    } else if (rotations[(size_t)rule.axis] == NO_GATE) {
+      rotations[(size_t)rule.axis] = id;
+    }
+  }
+}
+
+/**
+ * Returns the rotation angle of the given gate, normalized to [-pi, pi].
+ */
+double Peephole::angle_of(const OpenQLGateDescription &desc) const {
+  const Rule &rule = rules[desc.id];
+  return std::remainder(rule.has_angle ? desc.angle : rule.angle, 2.0 * M_PI);
+}
+
+/**
+ * Returns whether the given gate is the identity.
+ */
+bool Peephole::is_identity(const OpenQLGateDescription &desc) const {
+  const Rule &rule = rules[desc.id];
+  if (rule.identity) {
+    return true;
+  }
+  return rule.axis != Axis::None && rule.has_angle && std::abs(angle_of(desc)) < epsilon;
+}
+
+/**
+ * Tries to merge the given rotation into the given preceding rotation on the
+ * same qubit. Returns false if the gatemap has no gate for the merged angle.
+ * Otherwise, the preceding rotation is replaced by the merged one, unless the
+ * merged rotation is the identity, in which case identity is set.
+ */
+bool Peephole::merge(
+  OpenQLGateDescription &into,
+  const OpenQLGateDescription &desc,
+  bool &identity
+) const {
+  double angle = std::remainder(angle_of(into) + angle_of(desc), 2.0 * M_PI);
+  identity = std::abs(angle) < epsilon;
+  if (identity) {
+    return true;
+  }
+
+  // Prefer the parameterized rotation gate, as it can represent any angle.
+  size_t axis = (size_t)rules[desc.id].axis;
+  if (rotations[axis] != NO_GATE) {
+    into.id = rotations[axis];
+    into.angle = angle;
+    return true;
+  }
+  for (const auto &fixed : fixed_rotations[axis]) {
+    if (std::abs(std::remainder(fixed.second - angle, 2.0 * M_PI)) < epsilon) {
+      into.id = fixed.first;
+      into.angle = 0.0;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Optimizes the given gates, using virtual qubit indices, in place.
+ */
+void Peephole::optimize(std::vector<OpenQLGateDescription> &gates) {
+  for (std::vector<size_t> &wire : wires) {
+    wire.clear();
+  }
+  removed.assign(gates.size(), false);
+
+  for (size_t index = 0; index < gates.size(); index++) {
+    OpenQLGateDescription &desc = gates[index];
+    const Rule &rule = rules[desc.id];
+    for (size_t qubit : desc.qubits) {
+      if (qubit >= wires.size()) {
+        wires.resize(qubit + 1);
+      }
+    }
+
+    if (rule.enabled && !desc.qubits.empty()) {
+
+      // Drop identity gates.
+      if (is_identity(desc)) {
+        removed[index] = true;
+        identities_dropped++;
+        continue;
+      }
+
+      // Find the preceding gate that this gate may be combined with. It must
+      // be the last remaining gate on all qubits of this gate, and act on no
+      // other qubits.
+      size_t prev = NO_GATE;
+      if (!wires[desc.qubits[0]].empty()) {
+        prev = wires[desc.qubits[0]].back();
+        if (!rules[gates[prev].id].enabled || gates[prev].qubits.size() != desc.qubits.size()) {
+          prev = NO_GATE;
+        } else {
+          for (size_t qubit : desc.qubits) {
+            if (wires[qubit].empty() || wires[qubit].back() != prev) {
+              prev = NO_GATE;
+              break;
+            }
+          }
+        }
+      }
+
+      // Combine the gates if possible. If they cancel out, the gate before
+      // them becomes the last remaining gate again.
+      if (prev != NO_GATE) {
+        OpenQLGateDescription &before = gates[prev];
+        const Rule &before_rule = rules[before.id];
+        bool cancel = false;
+        if (before_rule.inverse == desc.id && (rule.symmetric || before.qubits == desc.qubits)) {
+          inverses_cancelled++;
+          cancel = true;
+        } else if (rule.axis != Axis::None && rule.axis == before_rule.axis) {
+          bool identity;
+          if (merge(before, desc, identity)) {
+            rotations_merged++;
+            if (!identity) {
+              removed[index] = true;
+              continue;
+            }
+            identities_dropped++;
+            cancel = true;
+          }
+        }
+        if (cancel) {
+          removed[prev] = true;
+          removed[index] = true;
+          for (size_t qubit : desc.qubits) {
+            wires[qubit].pop_back();
+          }
+          continue;
+        }
+      }
+    }
+
+    for (size_t qubit : desc.qubits) {
+      wires[qubit].push_back(index);
+    }
+  }
+
+  // Remove the dropped gates.
+  size_t count = 0;
+  for (size_t index = 0; index < gates.size(); index++) {
+    if (removed[index]) {
+      continue;
+    }
+    if (count != index) {
+      gates[count] = std::move(gates[index]);
+    }
+    count++;
+  }
+  gates.resize(count);
+}
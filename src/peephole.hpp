@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <json.h>
+#include "gates.hpp"
+
+/**
+ * Peephole optimizer for the gates of a kernel, run before the kernel is
+ * mapped.
+ *
+ * The optimizer walks over the gates in program order, keeping track of the
+ * last remaining gate on each qubit. When a gate acts on exactly the same
+ * qubits as the last remaining gate on each of them, the two are combined if
+ * possible:
+ *
+ *  - rotations about the same axis (the rx, ry and rz gates, as well as
+ *    fixed-angle gates like x, s and t) are merged into a single rotation,
+ *    provided that the gatemap has a gate for the merged angle;
+ *  - gates that are each other's inverse (h and h, cnot and cnot, s and
+ *    s_dag, and so on) cancel out.
+ *
+ * Identity gates (i, identity matrices and rotations by a multiple of 2 pi)
+ * are simply dropped. Because removing a gate exposes the gate before it,
+ * this cascades; h x x h disappears entirely.
+ *
+ * Global phase is ignored for gates without control qubits, but not for
+ * controlled gates, where it becomes a relative phase. Measurements, preps,
+ * and gates for which the platform sets disable_optimization are never
+ * touched, and they block optimization across them on their qubits.
+ */
+class Peephole {
+private:
+
+  /**
+   * Rotation axis of a gate.
+   */
+  enum class Axis : uint8_t {
+    None,
+    X,
+    Y,
+    Z
+  };
+
+  /**
+   * What the optimizer knows about a gate.
+   */
+  class Rule {
+  public:
+
+    // Whether the optimizer may touch the gate at all.
+    bool enabled = false;
+
+    // Whether the gate uses the angle argument.
+    bool has_angle = false;
+
+    // Whether the gate is the identity.
+    bool identity = false;
+
+    // Whether the order of the qubits of the gate doesn't matter.
+    bool symmetric = false;
+
+    // ID of the gate that is the exact inverse of this gate, or -1 if there
+    // is none.
+    size_t inverse = (size_t)-1;
+
+    // Rotation axis, for uncontrolled single-qubit rotations, and the
+    // rotation angle, for rotations that don't take an angle argument.
+    Axis axis = Axis::None;
+    double angle = 0.0;
+
+  };
+
+  /**
+   * Rules for each gate, indexed by gate ID.
+   */
+  std::vector<Rule> rules;
+
+  /**
+   * For each axis, the ID of the parameterized rotation gate for it, or -1
+   * if the gatemap has none.
+   */
+  size_t rotations[4];
+
+  /**
+   * For each axis, the IDs and angles of the fixed-angle rotation gates for
+   * it.
+   */
+  std::vector<std::pair<size_t, double>> fixed_rotations[4];
+
+  /**
+   * Accuracy for comparing matrices and angles.
+   */
+  double epsilon;
+
+  /**
+   * For each qubit, the indices of the remaining gates on it in the kernel
+   * being optimized, and for each gate in that kernel whether it was
+   * removed. Kept around to reuse their capacity.
+   */
+  std::vector<std::vector<size_t>> wires;
+  std::vector<bool> removed;
+
+  /**
+   * Returns the rotation angle of the given gate, normalized to [-pi, pi].
+   */
+  double angle_of(const OpenQLGateDescription &desc) const;
+
+  /**
+   * Returns whether the given gate is the identity.
+   */
+  bool is_identity(const OpenQLGateDescription &desc) const;
+
+  /**
+   * Tries to merge the given rotation into the given preceding rotation on
+   * the same qubit. Returns false if the gatemap has no gate for the merged
+   * angle. Otherwise, the preceding rotation is replaced by the merged one,
+   * unless the merged rotation is the identity, in which case identity is
+   * set.
+   */
+  bool merge(OpenQLGateDescription &into, const OpenQLGateDescription &desc, bool &identity) const;
+
+public:
+
+  /**
+   * Number of rotations merged into the preceding rotation.
+   */
+  size_t rotations_merged = 0;
+
+  /**
+   * Number of pairs of gates that cancelled out.
+   */
+  size_t inverses_cancelled = 0;
+
+  /**
+   * Number of identity gates dropped, including rotations that merged into
+   * the identity.
+   */
+  size_t identities_dropped = 0;
+
+  /**
+   * Prepares the optimizer for the gates in the given gatemap. Gates for
+   * which the given OpenQL instruction settings (the "instructions" section
+   * of the hardware configuration) set disable_optimization are left alone.
+   */
+  Peephole(const OpenQLGateMap &gatemap, const nlohmann::json &instruction_settings);
+
+  /**
+   * Optimizes the given gates, using virtual qubit indices, in place.
+   */
+  void optimize(std::vector<OpenQLGateDescription> &gates);
+
+};
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <placement.hpp>
+
+// Number of consecutive perturbations that fail to improve on the best
+// placement after which the search is considered converged.
+static const size_t MAX_FAILED_PERTURBATIONS = 32;
+
+// Number of exchanges evaluated between checks of the time limit.
+static const size_t TIME_CHECK_INTERVAL = 4096;
+
+/**
+ * State of the local search.
+ */
+struct Placer::Search {
+
+  // Number of exchanges that may still be evaluated.
+  size_t effort;
+
+  // Whether the time limit applies, and when it expires.
+  bool limited;
+  std::chrono::steady_clock::time_point deadline;
+
+  // Number of exchanges evaluated since the time limit was last checked.
+  size_t since_check = 0;
+
+  // The best placement found thus far and its cost.
+  std::vector<size_t> best;
+  double best_cost;
+
+  /**
+   * Accounts for the evaluation of an exchange. Returns false if the search
+   * must stop.
+   */
+  bool evaluate() {
+    if (!effort) {
+      return false;
+    }
+    effort--;
+    if (limited && ++since_check >= TIME_CHECK_INTERVAL) {
+      since_check = 0;
+      if (std::chrono::steady_clock::now() >= deadline) {
+        effort = 0;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Replaces the best placement if the given one is better.
+   */
+  void publish(const std::vector<size_t> &v2r, double cost) {
+    if (cost < best_cost) {
+      best = v2r;
+      best_cost = cost;
+    }
+  }
+
+};
+
+/**
+ * Prepares placement of the given gates, using virtual qubit indices, onto
+ * the given topology. The topology must outlive the placer, and its routing
+ * tables must have been computed.
+ */
+Placer::Placer(
+  const Topology &topology,
+  const OpenQLGateMap &gatemap,
+  const std::vector<OpenQLGateDescription> &gates
+) : topology(topology), num_qubits(topology.size()), interactions(topology.size()) {
+
+  // Accumulate the weights of the two-qubit gates, weighting each by the
+  // inverse of its depth.
+  std::vector<size_t> qubit_depth(num_qubits, 0);
+  std::map<std::pair<size_t, size_t>, double> weights;
+  for (const OpenQLGateDescription &desc : gates) {
+    size_t depth = 0;
+    for (size_t virt : desc.qubits) {
+      depth = std::max(depth, qubit_depth[virt]);
+    }
+    depth++;
+    for (size_t virt : desc.qubits) {
+      qubit_depth[virt] = depth;
+    }
+    if (desc.qubits.size() != 2 || gatemap.is_measure(desc.id)) {
+      continue;
+    }
+    size_t a = std::min(desc.qubits[0], desc.qubits[1]);
+    size_t b = std::max(desc.qubits[0], desc.qubits[1]);
+    if (a != b) {
+      weights[std::make_pair(a, b)] += 1.0 / depth;
+    }
+  }
+  for (const auto &weight : weights) {
+    interactions[weight.first.first].push_back({weight.first.second, weight.second});
+    interactions[weight.first.second].push_back({weight.first.first, weight.second});
+  }
+}
+
+/**
+ * Returns the cost contribution of the interactions of the given virtual
+ * qubit, when placed on the given physical qubit.
+ */
+double Placer::qubit_cost(const std::vector<size_t> &v2r, size_t virt, size_t phys) const {
+  double cost = 0.0;
+  for (const Interaction &interaction : interactions[virt]) {
+    cost += interaction.weight * (distance(phys, v2r[interaction.other]) - 1.0);
+  }
+  return cost;
+}
+
+/**
+ * Returns the cost of the given virtual to physical placement.
+ */
+double Placer::cost(const std::vector<size_t> &v2r) const {
+  double cost = 0.0;
+  for (size_t virt = 0; virt < num_qubits; virt++) {
+    cost += qubit_cost(v2r, virt, v2r[virt]);
+  }
+
+  // Each interaction was counted for both of its qubits.
+  return cost / 2.0;
+}
+
+/**
+ * Returns a greedy virtual to physical placement.
+ */
+std::vector<size_t> Placer::greedy() const {
+  const size_t UNPLACED = (size_t)-1;
+  std::vector<size_t> v2r(num_qubits, UNPLACED);
+  std::vector<bool> phys_used(num_qubits, false);
+
+  // Precompute the total interaction weight of each virtual qubit and the
+  // degree of each physical qubit.
+  std::vector<double> total_weight(num_qubits, 0.0);
+  for (size_t virt = 0; virt < num_qubits; virt++) {
+    for (const Interaction &interaction : interactions[virt]) {
+      total_weight[virt] += interaction.weight;
+    }
+  }
+  std::vector<size_t> degree(num_qubits, 0);
+  for (size_t a = 0; a < num_qubits; a++) {
+    for (size_t b = 0; b < num_qubits; b++) {
+      if (topology.adjacent(a, b)) {
+        degree[a]++;
+      }
+    }
+  }
+
+  // Place the interacting virtual qubits one by one, each time picking the
+  // one that interacts most with the qubits placed thus far, and putting it
+  // on the free physical qubit closest to its partners. When there is no
+  // such qubit, start a new group with the most interacting qubit on the
+  // best connected free physical qubit.
+  std::vector<double> placed_weight(num_qubits, 0.0);
+  while (true) {
+    size_t virt = UNPLACED;
+    for (size_t candidate = 0; candidate < num_qubits; candidate++) {
+      if (v2r[candidate] != UNPLACED || total_weight[candidate] == 0.0) {
+        continue;
+      }
+      if (virt == UNPLACED
+        || placed_weight[candidate] > placed_weight[virt]
+        || (placed_weight[candidate] == placed_weight[virt]
+          && total_weight[candidate] > total_weight[virt])
+      ) {
+        virt = candidate;
+      }
+    }
+    if (virt == UNPLACED) {
+      break;
+    }
+
+    size_t best_phys = UNPLACED;
+    double best_cost = 0.0;
+    for (size_t phys = 0; phys < num_qubits; phys++) {
+      if (phys_used[phys]) {
+        continue;
+      }
+      double cost = 0.0;
+      for (const Interaction &interaction : interactions[virt]) {
+        if (v2r[interaction.other] != UNPLACED) {
+          cost += interaction.weight * distance(phys, v2r[interaction.other]);
+        }
+      }
+      if (best_phys == UNPLACED
+        || cost < best_cost
+        || (cost == best_cost && degree[phys] > degree[best_phys])
+      ) {
+        best_phys = phys;
+        best_cost = cost;
+      }
+    }
+
+    v2r[virt] = best_phys;
+    phys_used[best_phys] = true;
+    for (const Interaction &interaction : interactions[virt]) {
+      placed_weight[interaction.other] += interaction.weight;
+    }
+  }
+
+  // Put the remaining qubits on the remaining physical qubits in order.
+  size_t phys = 0;
+  for (size_t virt = 0; virt < num_qubits; virt++) {
+    if (v2r[virt] != UNPLACED) {
+      continue;
+    }
+    while (phys_used[phys]) {
+      phys++;
+    }
+    v2r[virt] = phys;
+    phys_used[phys] = true;
+  }
+
+  return v2r;
+}
+
+/**
+ * Improves the given placement in place by first-improvement descent,
+ * until no exchange of two physical qubits improves its cost. Improved
+ * placements are recorded in the search state. Returns false if the
+ * search ran out of effort or time before converging.
+ */
+bool Placer::descend(std::vector<size_t> &v2r, Search &search) const {
+  double current = cost(v2r);
+  search.publish(v2r, current);
+  bool improved = true;
+  while (improved) {
+    improved = false;
+    for (size_t a = 0; a < num_qubits; a++) {
+      if (interactions[a].empty()) {
+        continue;
+      }
+      for (size_t b = 0; b < num_qubits; b++) {
+        if (a == b) {
+          continue;
+        }
+        if (!search.evaluate()) {
+          search.publish(v2r, current);
+          return false;
+        }
+        double before = qubit_cost(v2r, a, v2r[a]) + qubit_cost(v2r, b, v2r[b]);
+        std::swap(v2r[a], v2r[b]);
+        double after = qubit_cost(v2r, a, v2r[a]) + qubit_cost(v2r, b, v2r[b]);
+        if (after < before - 1.0e-9) {
+          current += after - before;
+          improved = true;
+        } else {
+          std::swap(v2r[a], v2r[b]);
+        }
+      }
+    }
+    if (improved) {
+      search.publish(v2r, current);
+    }
+  }
+  return true;
+}
+
+/**
+ * Returns the best virtual to physical placement found by evaluating at
+ * most the given number of exchanges, using the given seed for the local
+ * search. If time_limit is positive, the search also stops after that many
+ * seconds.
+ */
+std::vector<size_t> Placer::place(size_t effort, double time_limit, uint64_t seed) const {
+  std::vector<size_t> initial = greedy();
+  if (!effort || num_qubits < 2) {
+    return initial;
+  }
+
+  Search search;
+  search.effort = effort;
+  search.limited = time_limit > 0.0;
+  if (search.limited) {
+    search.deadline = std::chrono::steady_clock::now()
+      + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(time_limit));
+  }
+  search.best = initial;
+  search.best_cost = cost(initial);
+
+  // Descend from the greedy placement, then keep perturbing the best
+  // placement found thus far with a few random exchanges and descending
+  // again, until this stops finding improvements or the effort runs out.
+  std::mt19937_64 rng(seed);
+  std::vector<size_t> v2r = initial;
+  double previous = search.best_cost;
+  size_t failed = 0;
+  while (descend(v2r, search)) {
+    v2r = search.best;
+    if (search.best_cost <= 0.0) {
+      break;
+    } else if (search.best_cost < previous - 1.0e-9) {
+      previous = search.best_cost;
+      failed = 0;
+    } else if (++failed >= MAX_FAILED_PERTURBATIONS) {
+      break;
+    }
+    size_t exchanges = 2 + rng() % std::max<size_t>(1, num_qubits / 4);
+    for (size_t i = 0; i < exchanges; i++) {
+      std::swap(v2r[rng() % num_qubits], v2r[rng() % num_qubits]);
+    }
+  }
+  return search.best;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "gates.hpp"
+#include "topology.hpp"
+
+/**
+ * Initial placement of virtual qubits onto physical qubits.
+ *
+ * The cost of a placement is the sum over all two-qubit gates of the number
+ * of swaps the gate would need if it were routed on its own, that is, the
+ * distance between its physical qubits minus one. Gates are weighted by the
+ * inverse of their depth in the circuit, as the placement mostly matters for
+ * the gates near the start; later gates are affected by the swaps that the
+ * mapper inserts anyway.
+ *
+ * Placement starts with a cheap greedy placement, which is then improved by
+ * a local search (pairwise exchanges of physical qubits) until the search
+ * converges or has evaluated a given number of exchanges, whichever comes
+ * first. The search is driven by a seeded random number generator, so the
+ * result only depends on the seed. An optional time limit can be set as a
+ * safety cap on top of that, in which case the result does depend on timing
+ * if the limit is hit.
+ */
+class Placer {
+private:
+
+  /**
+   * An interaction between two virtual qubits.
+   */
+  struct Interaction {
+
+    // The other virtual qubit.
+    size_t other;
+
+    // Sum of the weights of the two-qubit gates between the two qubits.
+    double weight;
+
+  };
+
+  /**
+   * The platform topology, with its routing tables computed.
+   */
+  const Topology &topology;
+
+  /**
+   * Number of qubits, both virtual and physical.
+   */
+  size_t num_qubits;
+
+  /**
+   * Interactions per virtual qubit. Each interaction is listed for both
+   * qubits.
+   */
+  std::vector<std::vector<Interaction>> interactions;
+
+  /**
+   * Returns the distance between the given physical qubits.
+   */
+  double distance(size_t a, size_t b) const {
+    return topology.distance(a, b);
+  }
+
+  /**
+   * Returns the cost contribution of the interactions of the given virtual
+   * qubit, when placed on the given physical qubit.
+   */
+  double qubit_cost(const std::vector<size_t> &v2r, size_t virt, size_t phys) const;
+
+  /**
+   * State of the local search.
+   */
+  struct Search;
+
+  /**
+   * Improves the given placement in place by first-improvement descent,
+   * until no exchange of two physical qubits improves its cost. Improved
+   * placements are recorded in the search state. Returns false if the
+   * search ran out of effort or time before converging.
+   */
+  bool descend(std::vector<size_t> &v2r, Search &search) const;
+
+public:
+
+  /**
+   * Prepares placement of the given gates, using virtual qubit indices, onto
+   * the given topology. The topology must outlive the placer, and its routing
+   * tables must have been computed.
+   */
+  Placer(
+    const Topology &topology,
+    const OpenQLGateMap &gatemap,
+    const std::vector<OpenQLGateDescription> &gates);
+
+  /**
+   * Returns the cost of the given virtual to physical placement.
+   */
+  double cost(const std::vector<size_t> &v2r) const;
+
+  /**
+   * Returns a greedy virtual to physical placement.
+   */
+  std::vector<size_t> greedy() const;
+
+  /**
+   * Returns the best virtual to physical placement found by evaluating at
+   * most the given number of exchanges, using the given seed for the local
+   * search. If time_limit is positive, the search also stops after that many
+   * seconds.
+   */
+  std::vector<size_t> place(size_t effort, double time_limit, uint64_t seed) const;
+
+};
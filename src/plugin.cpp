@@ -0,0 +1,1314 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <plugin.hpp>
+
+// Alias the dqcsim::wrap namespace to something shorter.
+namespace dqcs = dqcsim::wrap;
+
+/**
+ * Parses a yes/no option value.
+ */
+static bool parse_bool(const std::string &value) {
+  if (value == "yes" || value == "true" || value == "1") {
+    return true;
+  } else if (value == "no" || value == "false" || value == "0") {
+    return false;
+  }
+  throw std::invalid_argument("Expected yes or no, found " + value);
+}
+
+/**
+ * Loads the defaults for the configuration from the environment.
+ */
+void MapperConfig::load_env() {
+  const char *s;
+  s = std::getenv("DQCSIM_OPENQL_HARDWARE_CONFIG");
+  if (s != nullptr) platform_json_fname = std::string(s);
+  s = std::getenv("DQCSIM_OPENQL_GATEMAP");
+  if (s != nullptr) gatemap_json_fname = std::string(s);
+  s = std::getenv("DQCSIM_OPENQL_SNAPSHOT");
+  if (s != nullptr) snapshot_fname = std::string(s);
+  s = std::getenv("DQCSIM_OPENQL_ROUTE_CACHE");
+  if (s != nullptr) route_cache_dir = std::string(s);
+  s = std::getenv("DQCSIM_OPENQL_STATS");
+  if (s != nullptr) stats_fname = std::string(s);
+  s = std::getenv("DQCSIM_OPENQL_TIMELINE");
+  if (s != nullptr) timeline_fname = std::string(s);
+  s = std::getenv("DQCSIM_OPENQL_PEEPHOLE");
+  if (s != nullptr) peephole = parse_bool(std::string(s));
+  s = std::getenv("DQCSIM_OPENQL_SWAP_CANCELLATION");
+  if (s != nullptr) swap_cancellation = parse_bool(std::string(s));
+  s = std::getenv("DQCSIM_OPENQL_VIRTUAL_SWAPS");
+  if (s != nullptr) virtual_swaps = parse_bool(std::string(s));
+  s = std::getenv("DQCSIM_OPENQL_COALESCE");
+  if (s != nullptr) coalesce = parse_bool(std::string(s));
+  s = std::getenv("DQCSIM_OPENQL_DEFER_MEASUREMENTS");
+  if (s != nullptr) defer_measurements = parse_bool(std::string(s));
+  s = std::getenv("DQCSIM_OPENQL_CAUSAL_FLUSH");
+  if (s != nullptr) causal_flush = parse_bool(std::string(s));
+  s = std::getenv("DQCSIM_OPENQL_RECORD");
+  if (s != nullptr) record_fname = std::string(s);
+  s = std::getenv("DQCSIM_OPENQL_REPLAY");
+  if (s != nullptr) replay_fname = std::string(s);
+  s = std::getenv("DQCSIM_OPENQL_DEBUG_DUMPS");
+  if (s != nullptr) debug_dumps = parse_bool(std::string(s));
+}
+
+/**
+ * Interprets the given initialization commands. Commands for interfaces
+ * other than openql_mapper are ignored.
+ *
+ * \throws std::invalid_argument when an openql_mapper command is not
+ * recognized or has the wrong number of arguments.
+ */
+void MapperConfig::load_cmds(dqcs::ArbCmdQueue &&cmds) {
+  for (; cmds.size(); cmds.next()) {
+    if (cmds.is_iface("openql_mapper")) {
+      if (cmds.is_oper("hardware_config")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.hardware_config");
+        } else {
+          platform_json_fname = cmds.get_arb_arg_string(0);
+        }
+      } else if (cmds.is_oper("gatemap")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.gatemap");
+        } else {
+          gatemap_json_fname = cmds.get_arb_arg_string(0);
+        }
+      } else if (cmds.is_oper("snapshot")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.snapshot");
+        } else {
+          snapshot_fname = cmds.get_arb_arg_string(0);
+        }
+      } else if (cmds.is_oper("option")) {
+        if (cmds.get_arb_arg_count() != 2) {
+          throw std::invalid_argument("Expected two arguments for openql_mapper.option");
+        } else {
+          options.emplace_back(cmds.get_arb_arg_string(0), cmds.get_arb_arg_string(1));
+        }
+      } else if (cmds.is_oper("trial")) {
+        if (cmds.get_arb_arg_count() % 2 != 0) {
+          throw std::invalid_argument("Expected key-value pairs for openql_mapper.trial");
+        } else {
+          std::vector<std::pair<std::string, std::string>> trial;
+          for (size_t i = 0; i < cmds.get_arb_arg_count(); i += 2) {
+            trial.emplace_back(cmds.get_arb_arg_string(i), cmds.get_arb_arg_string(i + 1));
+          }
+          trials.push_back(std::move(trial));
+        }
+      } else if (cmds.is_oper("trial_metric")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.trial_metric");
+        } else {
+          std::string metric = cmds.get_arb_arg_string(0);
+          if (metric == "swaps") {
+            trial_metric = TrialMetric::Swaps;
+          } else if (metric == "depth") {
+            trial_metric = TrialMetric::Depth;
+          } else {
+            throw std::invalid_argument("Expected swaps or depth for openql_mapper.trial_metric, found " + metric);
+          }
+        }
+      } else if (cmds.is_oper("route_cache")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.route_cache");
+        } else {
+          route_cache_dir = cmds.get_arb_arg_string(0);
+        }
+      } else if (cmds.is_oper("placement_effort")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.placement_effort");
+        } else {
+          placement_effort = std::stoul(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("placement_budget")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.placement_budget");
+        } else {
+          placement_budget = std::stoul(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("kernel_cache")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.kernel_cache");
+        } else {
+          kernel_cache_capacity = std::stoul(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("detect_cache")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.detect_cache");
+        } else {
+          detect_cache_capacity = std::stoul(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("fast_path")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.fast_path");
+        } else {
+          fast_path = parse_bool(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("peephole")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.peephole");
+        } else {
+          peephole = parse_bool(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("swap_cancellation")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.swap_cancellation");
+        } else {
+          swap_cancellation = parse_bool(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("virtual_swaps")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.virtual_swaps");
+        } else {
+          virtual_swaps = parse_bool(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("coalesce")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.coalesce");
+        } else {
+          coalesce = parse_bool(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("window_gates")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.window_gates");
+        } else {
+          window_gates = std::stoul(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("window_depth")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.window_depth");
+        } else {
+          window_depth = std::stoul(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("defer_measurements")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.defer_measurements");
+        } else {
+          defer_measurements = parse_bool(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("causal_flush")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.causal_flush");
+        } else {
+          causal_flush = parse_bool(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("stats_file")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.stats_file");
+        } else {
+          stats_fname = cmds.get_arb_arg_string(0);
+        }
+      } else if (cmds.is_oper("timeline_file")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.timeline_file");
+        } else {
+          timeline_fname = cmds.get_arb_arg_string(0);
+        }
+      } else if (cmds.is_oper("debug_dumps")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.debug_dumps");
+        } else {
+          debug_dumps = parse_bool(cmds.get_arb_arg_string(0));
+        }
+      } else if (cmds.is_oper("record")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.record");
+        } else {
+          record_fname = cmds.get_arb_arg_string(0);
+        }
+      } else if (cmds.is_oper("replay")) {
+        if (cmds.get_arb_arg_count() != 1) {
+          throw std::invalid_argument("Expected one argument for openql_mapper.replay");
+        } else {
+          replay_fname = cmds.get_arb_arg_string(0);
+        }
+      } else {
+        throw std::invalid_argument("Unknown command openql_mapper." + cmds.get_oper());
+      }
+    }
+  }
+}
+
+/**
+ * Starts a new kernel, representing a new measurement-delimited block.
+ */
+void MapperPlugin::new_kernel() {
+  kernel_gates.clear();
+  if (window_depth) {
+    kernel_depth = 0;
+    qubit_depth.assign(num_qubits, 0);
+  }
+  if (kernel_deferred) {
+    for (std::deque<size_t> &pending : pending_measures) {
+      pending.clear();
+    }
+    kernel_deferred = 0;
+  }
+  kernel_has_swap = false;
+}
+
+/**
+ * Initializes the operator with the given configuration.
+ */
+void MapperPlugin::initialize(Downstream &downstream, const MapperConfig &config) {
+  if (!config.timeline_fname.empty()) {
+    Timeline::enable();
+  }
+  TimelineScope scope("initialize");
+
+  // Check that we have a platform and gatemap description.
+  if (config.platform_json_fname.empty()) {
+    throw std::invalid_argument(
+      "Missing openql_mapper.hardware_config cmd/DQCSIM_OPENQL_HARDWARE_CONFIG env");
+  }
+  if (config.gatemap_json_fname.empty()) {
+    throw std::invalid_argument(
+      "Missing openql_mapper.gatemap cmd/DQCSIM_OPENQL_GATEMAP env");
+  }
+
+  // Copy the simple configuration values.
+  kernel_cache.set_capacity(config.kernel_cache_capacity);
+  fast_path = config.fast_path;
+  virtual_swaps = config.virtual_swaps;
+  coalesce = config.coalesce;
+  window_gates = config.window_gates;
+  window_depth = config.window_depth;
+  defer_measurements = config.defer_measurements;
+  causal_flush = config.causal_flush;
+  stats_fname = config.stats_fname;
+  timeline_fname = config.timeline_fname;
+  debug_dumps = config.debug_dumps;
+  trial_metric = config.trial_metric;
+  placement_effort = config.placement_effort;
+  placement_budget = config.placement_budget / 1000.0;
+  first_kernel = true;
+
+  // Set the OpenQL options.
+  for (const auto &option : config.options) {
+    session.set_option(option.first, option.second);
+  }
+  session.apply_options();
+
+  // Options overridden by one of the additional mapper configurations must
+  // be set explicitly for all other configurations too, otherwise the
+  // override would leak into them through OpenQL's global state. Use the
+  // value currently in effect for this.
+  for (const auto &trial : config.trials) {
+    for (const auto &option : trial) {
+      bool found = false;
+      for (const auto &base : config.options) {
+        found |= base.first == option.first;
+      }
+      if (!found) {
+        session.set_option(option.first, MappingSession::get_option(option.first));
+      }
+    }
+  }
+
+  // Construct the OpenQL platform.
+  platform = std::make_shared<ql::quantum_platform>("dqcsim_platform", config.platform_json_fname);
+  platform->print_info();
+  ql::set_platform(*platform);
+  num_qubits = platform->qubit_number;
+  topology = Topology(platform->topology, num_qubits);
+
+  // Load the routing tables and the DQCsim/OpenQL gatemap, either from a
+  // precompiled snapshot or from scratch.
+  // TODO: the epsilon value should probably be configurable.
+  if (!config.snapshot_fname.empty()) {
+    ScopedTimer timer(stats.routes_time);
+    std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>(config.snapshot_fname);
+    snapshot->check_topology(topology);
+    topology.use_routes(snapshot, snapshot->get_distances());
+    gatemap = std::make_shared<OpenQLGateMap>(snapshot->get_specs(), snapshot->get_epsilon());
+  } else {
+    {
+      ScopedTimer timer(stats.routes_time);
+      topology.compute_routes(config.route_cache_dir);
+    }
+    gatemap = std::make_shared<OpenQLGateMap>(config.gatemap_json_fname, 1.0e-6);
+  }
+  gatemap->set_detect_cache_capacity(config.detect_cache_capacity);
+
+  // Construct the peephole optimizer, if enabled.
+  if (config.peephole) {
+    peephole.reset(new Peephole(*gatemap, platform->instruction_settings));
+  } else {
+    peephole.reset();
+  }
+
+  // Construct the swap optimizer, if enabled. Swaps can only be folded into
+  // cnots if the platform decomposes them into cnots anyway, which we need
+  // to get from the hardware configuration file ourselves.
+  if (config.swap_cancellation) {
+    size_t fold_id = (size_t)-1;
+    try {
+      std::ifstream ifs(config.platform_json_fname);
+      nlohmann::json hardware_config = nlohmann::json::parse(ifs, nullptr, true, true);
+      fold_id = SwapOptimizer::find_fold_gate(*gatemap, hardware_config);
+    } catch (const std::exception &e) {
+      DQCSIM_WARN("Failed to look for a swap decomposition, not folding swaps: %s", e.what());
+    }
+    if (fold_id != (size_t)-1) {
+      DQCSIM_INFO("Folding swaps into adjacent %s gates", gatemap->get_name(fold_id).c_str());
+    }
+    swap_optimizer.reset(new SwapOptimizer(*gatemap, num_qubits, fold_id));
+  } else {
+    swap_optimizer.reset();
+  }
+
+  // Construct the mapping session. The mapper makes random choices, so seed
+  // it from DQCsim's random number generator to make the simulation
+  // reproducible.
+  session.init(platform, gatemap);
+  session.seed(downstream.random());
+
+  // Construct the mapping sessions for the additional mapper
+  // configurations. Each takes the base options, overridden by its own.
+  trial_sessions.clear();
+  for (const auto &trial : config.trials) {
+    std::unique_ptr<MappingSession> trial_session(new MappingSession());
+    for (const auto &option : session.get_options()) {
+      trial_session->set_option(option.first, option.second);
+    }
+    for (const auto &option : trial) {
+      trial_session->set_option(option.first, option.second);
+    }
+    trial_session->init(platform, gatemap);
+    trial_session->seed(downstream.random());
+    trial_sessions.push_back(std::move(trial_session));
+  }
+
+  // Open the record/replay traces.
+  if (!config.record_fname.empty()) {
+    trace_writer.reset(new TraceWriter(config.record_fname, *gatemap));
+  }
+  if (!config.replay_fname.empty()) {
+    trace_reader.reset(new TraceReader(config.replay_fname, *gatemap, num_qubits));
+  }
+
+  // Construct the initial kernel.
+  new_kernel();
+
+  // Allocate the physical qubits downstream.
+  downstream.allocate(num_qubits);
+  DQCSIM_INFO("OpenQL platform with %d qubits loaded", (int)num_qubits);
+
+  // Initialize the virtual qubit allocator.
+  virt_alloc.reset(num_qubits);
+
+  // Initialize the placement and deferred measurement queues.
+  v2r_in.resize(num_qubits);
+  pending_measures.resize(num_qubits);
+  emit_loc.resize(num_qubits);
+  awaiting_measures.resize(num_qubits);
+
+  // Initialize the physical to downstream qubit permutation.
+  phys2down.resize(num_qubits);
+  for (size_t qubit = 0; qubit < num_qubits; qubit++) {
+    phys2down[qubit] = qubit;
+  }
+  coalesced_qubits.resize(num_qubits);
+
+  // Initialize the virt2phys map.
+  dqcs2virt.reserve(num_qubits + 1, num_qubits);
+  virt2phys.reserve(num_qubits, num_qubits);
+  for (size_t qubit = 0; qubit < num_qubits; qubit++) {
+    virt2phys.map(qubit, qubit);
+  }
+
+}
+
+/**
+ * Allocates the given upstream qubits.
+ */
+void MapperPlugin::allocate(Downstream &downstream, dqcs::QubitSet &&qubits) {
+  TimelineScope scope("allocate");
+
+  // Loop over the qubits that are to be allocated.
+  while (qubits.size()) {
+
+    // A new DQCsim upstream qubit index to allocate.
+    size_t dqcsim_qubit = qubits.pop().get_index();
+
+    // Allocate the first free OpenQL virtual qubit index. Error out if we
+    // can't find one. This means that too many qubits are currently live.
+    ssize_t virt_qubit = virt_alloc.allocate();
+    if (virt_qubit < 0) {
+      throw std::runtime_error("Upstream plugin requires too many live qubits!");
+    }
+    DQCSIM_DEBUG("Placed upstream qubit %d at virtual index %d", (int)dqcsim_qubit, (int)virt_qubit);
+    dqcs2virt.map(dqcsim_qubit, virt_qubit);
+
+    // Update the qubit counter.
+    dqcs_nq++;
+
+  }
+
+}
+
+/**
+ * Frees the given upstream qubits. Inverse of `allocate()`.
+ */
+void MapperPlugin::free(Downstream &downstream, dqcs::QubitSet &&qubits) {
+  TimelineScope scope("free");
+
+  // Loop over the qubits that are to be freed.
+  while (qubits.size()) {
+
+    // The DQCsim upstream qubit index to free.
+    size_t dqcsim_qubit = qubits.pop().get_index();
+
+    // Unmap it in the bimap and release the virtual qubit to do the free.
+    DQCSIM_DEBUG("Freed upstream qubit %d", (int)dqcsim_qubit);
+    ssize_t virt_qubit = dqcs2virt.forward_lookup(dqcsim_qubit);
+    if (virt_qubit >= 0) {
+      virt_alloc.release(virt_qubit);
+    }
+    dqcs2virt.unmap_upstream(dqcsim_qubit);
+
+  }
+
+}
+
+/**
+ * Dumps the current qubit map with debug verbosity.
+ */
+void MapperPlugin::dump_qubit_map() {
+  if (!debug_dumps) {
+    return;
+  }
+  std::string dump;
+  char lbuf[64];
+
+  // Print table header.
+  dump += "| upstream | virtual  | physical |downstream|\n";
+  dump += "|----------|----------|----------|----------|\n";
+
+  // Print mappings for all upstream qubits.
+  std::vector<bool> phys_printed(num_qubits);
+  for (size_t dqcs = 1; dqcs <= dqcs_nq; dqcs++) {
+    std::string dqcs_str = std::to_string(dqcs);
+    std::string virt_str = "-";
+    std::string phys_str = "-";
+    std::string down_str = "-";
+
+    ssize_t virt = dqcs2virt.forward_lookup(dqcs);
+    if (virt >= 0) {
+      virt_str = std::to_string(virt);
+      ssize_t phys = virt2phys.forward_lookup(virt);
+      if (phys >= 0) {
+        phys_printed[phys] = true;
+        phys_str = std::to_string(phys);
+        down_str = std::to_string(phys2down[phys] + 1);
+      }
+    }
+
+    snprintf(
+      lbuf, sizeof(lbuf), "| %8s | %8s | %8s | %8s |\n",
+      dqcs_str.c_str(), virt_str.c_str(), phys_str.c_str(), down_str.c_str());
+    dump += lbuf;
+  }
+
+  // Print mappings for any remaining physical qubits.
+  for (size_t phys = 0; phys < num_qubits; phys++) {
+    if (phys_printed[phys]) {
+      continue;
+    }
+    std::string dqcs_str = "-";
+    std::string virt_str = "-";
+    std::string phys_str = std::to_string(phys);
+    std::string down_str = std::to_string(phys2down[phys] + 1);
+
+    ssize_t virt = virt2phys.reverse_lookup(phys);
+    if (virt >= 0) {
+      virt_str = std::to_string(virt);
+    }
+
+    snprintf(
+      lbuf, sizeof(lbuf), "| %8s | %8s | %8s | %8s |\n",
+      dqcs_str.c_str(), virt_str.c_str(), phys_str.c_str(), down_str.c_str());
+    dump += lbuf;
+  }
+
+  DQCSIM_DEBUG("Current qubit mapping:\n%s", dump.c_str());
+}
+
+/**
+ * Dumps a gate with debug verbosity.
+ */
+void MapperPlugin::dump_gate(
+  const std::string &prefix,
+  const std::string &qubit_type,
+  const OpenQLGateDescription &desc
+) {
+  if (!debug_dumps) {
+    return;
+  }
+  std::string qubits_string;
+  for (size_t qubit : desc.qubits) {
+    if (!qubits_string.empty()) {
+      qubits_string += ", ";
+    }
+    qubits_string += std::to_string(qubit);
+  }
+  DQCSIM_DEBUG(
+    "%s gate %s with %s qubit(s) %s and angle %f",
+    prefix.c_str(), gatemap->get_name(desc.id).c_str(), qubit_type.c_str(),
+    qubits_string.c_str(), desc.angle);
+}
+
+/**
+ * Prepares for sending the gates of the current kernel downstream. Must be
+ * called before the qubit placement is updated.
+ */
+void MapperPlugin::begin_emit() {
+  if (kernel_deferred) {
+    for (size_t virt = 0; virt < num_qubits; virt++) {
+      emit_loc[v2r_in[virt]] = virt;
+    }
+  }
+}
+
+/**
+ * Sends a gate on the given physical qubits downstream, through the swap
+ * optimizer if enabled.
+ */
+void MapperPlugin::send_gate(
+  Downstream &downstream,
+  size_t id,
+  const std::vector<size_t> &phys_qubits,
+  double angle
+) {
+  bool is_swap = phys_qubits.size() == 2 && gatemap->is_swap(id);
+  if (virtual_swaps && is_swap) {
+
+    // Swap the downstream qubits instead of their states.
+    std::swap(phys2down[phys_qubits[0]], phys2down[phys_qubits[1]]);
+    stats.swaps_virtual++;
+
+  } else {
+    down_qubits.clear();
+    for (size_t phys : phys_qubits) {
+      down_qubits.push_back(phys2down[phys]);
+    }
+    if (swap_optimizer) {
+      swap_optimizer->push(id, down_qubits, angle);
+      for (size_t index = 0; index < swap_optimizer->get_num_ready(); index++) {
+        const OpenQLGateDescription &ready = swap_optimizer->get_ready(index);
+        emit_gate(downstream, ready.id, ready.qubits, ready.angle);
+      }
+    } else {
+      emit_gate(downstream, id, down_qubits, angle);
+    }
+  }
+
+  // Keep track of which upstream qubit each deferred measurement belongs to.
+  // The mapper starts from the placement at the start of the kernel, so the
+  // swaps it inserted are all we need to follow.
+  if (kernel_deferred) {
+    if (is_swap) {
+      std::swap(emit_loc[phys_qubits[0]], emit_loc[phys_qubits[1]]);
+    } else if (gatemap->is_measure(id)) {
+      for (size_t phys : phys_qubits) {
+        std::deque<size_t> &pending = pending_measures[emit_loc[phys]];
+        if (!pending.empty()) {
+          awaiting_measures[phys2down[phys]].push_back(pending.front());
+          pending.pop_front();
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Actually sends a gate on the given downstream qubits, counting from zero,
+ * downstream. Measurements and preps may be held back to be coalesced with
+ * the next, until flush_coalesced() is called.
+ */
+void MapperPlugin::emit_gate(
+  Downstream &downstream,
+  size_t id,
+  const std::vector<size_t> &down_qubits,
+  double angle
+) {
+
+  // Measurements and preps were split up into one gate per qubit in gate(),
+  // so join consecutive ones of the same kind back up. They can only be
+  // joined if they're on different qubits, as a single gate can't act on a
+  // qubit twice.
+  if (coalesce && down_qubits.size() == 1 && gatemap->get_info(id).multi_qubit_parallel) {
+    size_t down = down_qubits[0];
+    if (coalescing && coalesced.id == id && !coalesced_qubits[down]) {
+      coalesced.qubits.push_back(down + 1);
+      coalesced_qubits[down] = true;
+      stats.gates_coalesced++;
+      return;
+    }
+    flush_coalesced(downstream);
+    coalescing = true;
+    coalesced.id = id;
+    coalesced.angle = angle;
+    coalesced.multi_qubit_parallel = true;
+    coalesced.qubits.clear();
+    coalesced.qubits.push_back(down + 1);
+    coalesced_qubits[down] = true;
+    return;
+  }
+  flush_coalesced(downstream);
+
+  OpenQLGateDescription &desc = send_desc;
+  desc.id = id;
+  desc.angle = angle;
+  desc.multi_qubit_parallel = false;
+  desc.qubits.clear();
+  for (size_t down : down_qubits) {
+    desc.qubits.push_back(down + 1);
+  }
+  dump_gate("Sending", "downstream", desc);
+  downstream.gate(construct(desc));
+  stats.gates_out++;
+}
+
+/**
+ * Constructs the DQCsim gate for the given gate on downstream qubits.
+ */
+dqcs::Gate MapperPlugin::construct(const OpenQLGateDescription &desc) {
+  TimelineScope scope("construct");
+  return gatemap->construct(desc);
+}
+
+/**
+ * Sends the gates held back by the swap optimizer downstream. Must be called
+ * before anything but a measurement could observe the downstream state.
+ */
+void MapperPlugin::flush_gates(Downstream &downstream) {
+  if (swap_optimizer) {
+    swap_optimizer->flush();
+    for (size_t index = 0; index < swap_optimizer->get_num_ready(); index++) {
+      const OpenQLGateDescription &ready = swap_optimizer->get_ready(index);
+      emit_gate(downstream, ready.id, ready.qubits, ready.angle);
+    }
+  }
+  flush_coalesced(downstream);
+}
+
+/**
+ * Sends the measurement or prep gate that is being coalesced downstream, if
+ * any.
+ */
+void MapperPlugin::flush_coalesced(Downstream &downstream) {
+  if (!coalescing) {
+    return;
+  }
+  coalescing = false;
+  for (size_t qubit : coalesced.qubits) {
+    coalesced_qubits[qubit - 1] = false;
+  }
+  dump_gate("Sending", "downstream", coalesced);
+  downstream.gate(construct(coalesced));
+  stats.gates_out++;
+}
+
+/**
+ * Returns whether mapping result a is better than b according to the
+ * configured trial metric.
+ */
+bool MapperPlugin::trial_is_better(
+  const MappingSession::Result &a,
+  const MappingSession::Result &b
+) const {
+  switch (trial_metric) {
+    case TrialMetric::Depth:
+      if (a.depth != b.depth) {
+        return a.depth < b.depth;
+      }
+      return a.swaps_inserted < b.swaps_inserted;
+    default:
+      if (a.swaps_inserted != b.swaps_inserted) {
+        return a.swaps_inserted < b.swaps_inserted;
+      }
+      return a.depth < b.depth;
+  }
+}
+
+/**
+ * Returns whether all gates in the current kernel can be executed without
+ * routing, given the current placement; that is, whether they're all
+ * single-qubit gates or two-qubit gates acting on adjacent physical qubits.
+ */
+bool MapperPlugin::kernel_is_executable() const {
+  for (const OpenQLGateDescription &desc : kernel_gates) {
+    const std::vector<size_t> &ops = desc.qubits;
+    if (ops.size() > 2) {
+      return false;
+    }
+    if (ops.size() == 2 && !topology.adjacent(v2r_in[ops[0]], v2r_in[ops[1]])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * This function runs the mapper for the gates queued up thus far and sends
+ * the mapped gates downstream.
+ */
+void MapperPlugin::run_mapper(Downstream &downstream) {
+  TimelineScope scope("run_mapper");
+
+  // If the current kernel is empty, we don't have to do anything.
+  if (kernel_gates.empty()) {
+    return;
+  }
+  stats.record_kernel_size(kernel_gates.size());
+
+  // Remove redundant gates from the kernel. If nothing remains, there's
+  // nothing to map.
+  if (peephole) {
+    {
+      ScopedTimer timer(stats.peephole_time);
+      peephole->optimize(kernel_gates);
+    }
+    if (kernel_gates.empty()) {
+      new_kernel();
+      return;
+    }
+  }
+
+  // If this is the first kernel, all qubits are still in their initial
+  // state, so we can pick the initial placement if the kernel needs
+  // routing.
+  bool place = first_kernel;
+  first_kernel = false;
+
+  // Get the current placement.
+  for (size_t virt = 0; virt < num_qubits; virt++) {
+    ssize_t phys = virt2phys.forward_lookup(virt);
+    if (phys < 0) {
+      throw std::runtime_error(
+        "Missing mapping from virtual qubit index " + std::to_string(virt) + " to physical");
+    }
+    v2r_in[virt] = phys;
+  }
+
+  // Dump the current qubit map.
+  dump_qubit_map();
+
+  // If the kernel doesn't need any routing, don't bother invoking the
+  // mapper; the gates can be sent downstream as they are, and the qubit
+  // mapping doesn't change.
+  if (fast_path && kernel_is_executable()) {
+    DQCSIM_DEBUG("Kernel needs no routing, bypassing mapper");
+    ScopedTimer timer(stats.emit_time);
+    begin_emit();
+    for (const OpenQLGateDescription &desc : kernel_gates) {
+      phys_qubits.clear();
+      for (size_t virt : desc.qubits) {
+        phys_qubits.push_back(v2r_in[virt]);
+      }
+      send_gate(downstream, desc.id, phys_qubits, desc.angle);
+    }
+    flush_coalesced(downstream);
+    stats.kernels_fast_path++;
+    new_kernel();
+    return;
+  }
+
+  // Build the key identifying this kernel for the cache and the traces. The
+  // key consists of the gates in the kernel and the current placement.
+  std::string key;
+  uint64_t hash = 0;
+  if (kernel_cache.enabled() || trace_writer || trace_reader) {
+    if (place) {
+      // Results for kernels that got an initial placement are only valid
+      // while all qubits are in their initial state, so their key must be
+      // distinct from that of the same kernel later on.
+      KernelCache::append_index(key, (size_t)-1);
+    }
+    for (size_t virt = 0; virt < num_qubits; virt++) {
+      KernelCache::append_index(key, v2r_in[virt]);
+    }
+    for (const OpenQLGateDescription &desc : kernel_gates) {
+      KernelCache::append_gate(key, desc.id, desc.qubits, desc.angle);
+    }
+    if (trace_writer || trace_reader) {
+      hash = trace_hash(key);
+    }
+  }
+
+  // Take the mapping result from the replay trace if it matches. Once the
+  // current run diverges from the trace, stop replaying.
+  const KernelCache::Entry *result = nullptr;
+  if (trace_reader) {
+    uint64_t trace_hash;
+    if (!trace_reader->next(trace_hash, replayed)) {
+      DQCSIM_WARN("End of replay trace reached; mapping the remaining kernels normally");
+      trace_reader.reset();
+    } else if (
+      trace_hash != hash
+      || (!replayed.v2r_in.empty() && replayed.v2r_in.size() != num_qubits)
+      || replayed.v2r_out.size() != num_qubits
+    ) {
+      DQCSIM_WARN("Run diverged from replay trace; mapping the remaining kernels normally");
+      trace_reader.reset();
+    } else {
+      DQCSIM_DEBUG("Using replayed mapping result for kernel");
+      stats.kernels_replayed++;
+      result = &replayed;
+    }
+  }
+
+  // Look for a cached mapping result for this kernel.
+  if (result == nullptr && kernel_cache.enabled()) {
+    result = kernel_cache.lookup(key);
+    if (result != nullptr) {
+      DQCSIM_DEBUG("Using cached mapping result for kernel");
+      stats.kernels_cached++;
+    }
+  }
+
+  // Run the mapper on the kernel if we don't have a cached result. If this
+  // is the first kernel, choose the initial placement first.
+  KernelCache::Entry fresh;
+  if (result == nullptr) {
+    if (place) {
+      ScopedTimer timer(stats.placement_time);
+      Placer placer(topology, *gatemap, kernel_gates);
+      v2r_in = placer.place(placement_effort, placement_budget, downstream.random());
+    }
+    MappingSession::Result mapped;
+    {
+      ScopedTimer timer(stats.map_time);
+      mapped = session.map(kernel_gates, v2r_in);
+
+      // Map the kernel with the additional mapper configurations as well,
+      // and keep the best result. OpenQL's options are process-wide state,
+      // so the sessions can't map concurrently; they're tried in turn.
+      bool trial_won = false;
+      for (const auto &trial_session : trial_sessions) {
+        MappingSession::Result candidate = trial_session->map(kernel_gates, v2r_in);
+        stats.trials_mapped++;
+        if (trial_is_better(candidate, mapped)) {
+          mapped = std::move(candidate);
+          trial_won = true;
+        }
+      }
+      if (trial_won) {
+        stats.trials_won++;
+      }
+    }
+    stats.kernels_mapped++;
+    stats.swaps_inserted += mapped.swaps_inserted;
+
+    // Save the mapping result.
+    fresh.gates = std::move(mapped.gates);
+    if (place) {
+      fresh.v2r_in = v2r_in;
+    }
+    fresh.v2r_out = std::move(mapped.v2r_out);
+    if (kernel_cache.enabled()) {
+      result = kernel_cache.insert(std::move(key), std::move(fresh));
+    } else {
+      result = &fresh;
+    }
+  }
+
+  // Record the mapping result.
+  if (trace_writer) {
+    trace_writer->write(hash, *result);
+  }
+
+  // Update our copy of the virtual to physical map based on the mapping
+  // result.
+  ScopedTimer timer(stats.emit_time);
+  if (!result->v2r_in.empty()) {
+    v2r_in = result->v2r_in;
+  }
+  begin_emit();
+  virt2phys.clear();
+  for (size_t virt = 0; virt < num_qubits; virt++) {
+    if (result->v2r_out[virt] != QubitBiMap::UNMAPPED) {
+      virt2phys.map(virt, result->v2r_out[virt]);
+    }
+  }
+
+  // Dump the new qubit map.
+  dump_qubit_map();
+
+  // Send the gates downstream.
+  for (const OpenQLGateDescription &mapped : result->gates) {
+    send_gate(downstream, mapped.id, mapped.qubits, mapped.angle);
+  }
+
+  // A measurement being coalesced must not be held back any longer, as the
+  // frontend may be waiting for its result.
+  flush_coalesced(downstream);
+
+  // Construct a new kernel for the next batch.
+  new_kernel();
+
+}
+
+/**
+ * Maps and sends downstream only the gates in the causal cone of the gates in
+ * the current kernel starting at the given index, that is, those gates and
+ * the gates they depend on through their qubits. The other gates are left in
+ * the kernel. They commute with the ones in the cone, and they use virtual
+ * qubit indices, so they can simply be mapped later, starting from the
+ * placement the cone leaves behind.
+ */
+void MapperPlugin::flush_cone(Downstream &downstream, size_t first) {
+
+  // Find the gates in the cone by walking backwards through the kernel,
+  // adding every gate that acts on a qubit in the cone, and its qubits. Any
+  // gate that is left out thus doesn't share a qubit with any later gate in
+  // the cone, so it can be moved past them.
+  cone_qubits.assign(num_qubits, false);
+  cone_gates.assign(kernel_gates.size(), false);
+  size_t cone_size = 0;
+  for (size_t index = kernel_gates.size(); index-- > 0; ) {
+    const OpenQLGateDescription &desc = kernel_gates[index];
+    bool in_cone = index >= first;
+    for (size_t virt : desc.qubits) {
+      in_cone |= cone_qubits[virt];
+    }
+    if (!in_cone) {
+      continue;
+    }
+    cone_gates[index] = true;
+    cone_size++;
+    for (size_t virt : desc.qubits) {
+      cone_qubits[virt] = true;
+    }
+  }
+  if (cone_size == kernel_gates.size()) {
+    run_mapper(downstream);
+    return;
+  }
+
+  // Move the gates outside the cone out of the kernel, in order.
+  buffered_gates.clear();
+  size_t count = 0;
+  for (size_t index = 0; index < kernel_gates.size(); index++) {
+    if (!cone_gates[index]) {
+      buffered_gates.push_back(std::move(kernel_gates[index]));
+    } else {
+      if (count != index) {
+        kernel_gates[count] = std::move(kernel_gates[index]);
+      }
+      count++;
+    }
+  }
+  kernel_gates.resize(count);
+  DQCSIM_DEBUG(
+    "Flushing %d gate(s) in the causal cone, leaving %d gate(s) queued",
+    (int)count, (int)buffered_gates.size());
+  stats.cone_flushes++;
+  stats.cone_gates_queued += buffered_gates.size();
+
+  // Map and send the cone, and start the next kernel with the remaining
+  // gates.
+  run_mapper(downstream);
+  kernel_gates.swap(buffered_gates);
+  for (const OpenQLGateDescription &desc : kernel_gates) {
+    if (window_depth) {
+      track_depth(desc.qubits);
+    }
+    kernel_has_swap |= gatemap->is_swap(desc.id);
+  }
+}
+
+/**
+ * Changes whether measurements are deferred. The current kernel is flushed
+ * when measurements are no longer deferred.
+ */
+void MapperPlugin::set_defer_measurements(Downstream &downstream, bool defer) {
+  if (defer_measurements && !defer) {
+    run_mapper(downstream);
+  }
+  defer_measurements = defer;
+}
+
+/**
+ * Updates the circuit depth of the current kernel for a gate added on the
+ * given virtual qubits.
+ */
+void MapperPlugin::track_depth(const std::vector<size_t> &qubits) {
+  size_t depth = 0;
+  for (size_t qubit : qubits) {
+    depth = std::max(depth, qubit_depth[qubit]);
+  }
+  depth++;
+  for (size_t qubit : qubits) {
+    qubit_depth[qubit] = depth;
+  }
+  kernel_depth = std::max(kernel_depth, depth);
+}
+
+/**
+ * Returns whether the current kernel has reached the configured gate count
+ * or depth window, and should thus be flushed.
+ */
+bool MapperPlugin::window_full() const {
+  if (window_gates && kernel_gates.size() >= window_gates) {
+    return true;
+  }
+  if (window_depth && kernel_depth >= window_depth) {
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Handles a gate received from upstream, returning the measurement results
+ * to send upstream.
+ */
+dqcs::MeasurementSet MapperPlugin::gate(Downstream &downstream, dqcs::Gate &&gate) {
+  TimelineScope scope("gate");
+
+  // Convert the DQCsim gate to its OpenQL representation.
+  stats.gates_in++;
+  OpenQLGateDescription desc;
+  {
+    TimelineScope detect_scope("detect");
+    ScopedTimer timer(stats.detect_time);
+    desc = gatemap->detect(gate);
+  }
+  dump_gate("Receiving", "upstream", desc);
+
+  // Make sure that deferred measurements and swaps received from upstream
+  // don't end up in the same kernel.
+  bool deferred = defer_measurements && gate.has_measures();
+  if (defer_measurements) {
+    bool is_swap = gatemap->is_swap(desc.id);
+    if ((deferred && kernel_has_swap) || (is_swap && kernel_deferred)) {
+      run_mapper(downstream);
+    }
+    kernel_has_swap |= is_swap;
+  }
+
+  // The qubit indices in the vector currently use DQCsim indices. Convert
+  // them to virtual qubit indices. Translation to physical indices is done
+  // when the kernel is flushed, based on the placement at that time.
+  for (size_t i = 0; i < desc.qubits.size(); i++) {
+    size_t dqcs = desc.qubits[i];
+    ssize_t virt = dqcs2virt.forward_lookup(dqcs);
+    if (virt < 0) {
+      throw std::runtime_error(
+        "Missing mapping from DQCsim qubit index " + std::to_string(dqcs) + " to virtual");
+    }
+    desc.qubits[i] = virt;
+
+    // Remember which upstream qubit deferred measurements belong to.
+    if (deferred) {
+      pending_measures[virt].push_back(dqcs);
+      kernel_deferred++;
+      stats.measurements_deferred++;
+    }
+  }
+
+  // Add the gate to the current kernel.
+  size_t first = kernel_gates.size();
+  if (desc.multi_qubit_parallel) {
+    for (size_t qubit : desc.qubits) {
+      parallel_qubits.clear();
+      parallel_qubits.push_back(qubit);
+      if (window_depth) {
+        track_depth(parallel_qubits);
+      }
+      kernel_gates.push_back({desc.id, parallel_qubits, desc.angle, false});
+    }
+  } else {
+    if (window_depth) {
+      track_depth(desc.qubits);
+    }
+    kernel_gates.push_back(std::move(desc));
+  }
+
+  // If the gate was a measurement gate, run the mapper now. If we try to
+  // queue up the measurement, we might get a deadlock, because the frontend
+  // may end up needing the measurement result to determine what the next
+  // gate will be. With causal flushing, only the gates that the measurement
+  // depends on are mapped, unless deferred measurements are queued up too, as
+  // those must be flushed in order.
+  if (gate.has_measures() && !deferred) {
+    if (causal_flush && !kernel_deferred) {
+      flush_cone(downstream, first);
+    } else {
+      run_mapper(downstream);
+    }
+  } else if (window_full()) {
+    DQCSIM_DEBUG("Kernel window is full, flushing");
+    stats.window_flushes++;
+    run_mapper(downstream);
+  }
+
+  // Return the measurements requested by this gates.
+  dqcs::MeasurementSet measurements = dqcs::MeasurementSet();
+  if (gate.has_measures() && !deferred) {
+    dqcs::QubitSet measures = gate.get_measures();
+    while (measures.size()) {
+
+      // Get the upstream qubit reference.
+      dqcs::QubitRef up_ref = measures.pop();
+
+      // Convert from upstream qubit index to downstream.
+      size_t dqcs = up_ref.get_index();
+      ssize_t virt = dqcs2virt.forward_lookup(dqcs);
+      if (virt < 0) {
+        throw std::runtime_error(
+          "Missing mapping from DQCsim qubit index " + std::to_string(dqcs) + " to virtual");
+      }
+      ssize_t phys = virt2phys.forward_lookup(virt);
+      if (phys < 0) {
+        throw std::runtime_error(
+          "Missing mapping from virtual qubit index " + std::to_string(virt) + " to physical");
+      }
+      size_t down = phys2down[phys] + 1;
+
+      // Get the downstream qubit reference.
+      dqcs::QubitRef down_ref = dqcs::QubitRef(down);
+
+      // Get, convert, and save the measurement result.
+      dqcs::Measurement meas = downstream.get_measurement(down_ref);
+      meas.set_qubit(up_ref);
+      measurements.set(std::move(meas));
+
+    }
+  }
+
+  return measurements;
+}
+
+/**
+ * Handles a measurement result received from downstream, returning the
+ * measurement results to send upstream.
+ */
+dqcs::MeasurementSet MapperPlugin::modify_measurement(dqcs::Measurement &&measurement) {
+  dqcs::MeasurementSet measurements = dqcs::MeasurementSet();
+  size_t down = measurement.get_qubit().get_index() - 1;
+  if (down < awaiting_measures.size() && !awaiting_measures[down].empty()) {
+    measurement.set_qubit(dqcs::QubitRef(awaiting_measures[down].front()));
+    awaiting_measures[down].pop_front();
+    measurements.set(std::move(measurement));
+  }
+  return measurements;
+}
+
+/**
+ * Returns the performance counters of the operator and its caches as a JSON
+ * object.
+ */
+nlohmann::json MapperPlugin::stats_json() const {
+  nlohmann::json json = stats.to_json();
+  json["kernel_cache"] = {
+    {"capacity", kernel_cache.get_capacity()},
+    {"size", kernel_cache.size()},
+    {"hits", kernel_cache.hits},
+    {"misses", kernel_cache.misses},
+    {"evictions", kernel_cache.evictions}
+  };
+  if (peephole) {
+    json["peephole"] = {
+      {"rotations_merged", peephole->rotations_merged},
+      {"inverses_cancelled", peephole->inverses_cancelled},
+      {"identities_dropped", peephole->identities_dropped}
+    };
+  }
+  if (swap_optimizer) {
+    json["swap_optimizer"] = {
+      {"folding", swap_optimizer->is_folding()},
+      {"swaps_cancelled", swap_optimizer->swaps_cancelled},
+      {"swaps_folded", swap_optimizer->swaps_folded},
+      {"cnots_cancelled", swap_optimizer->cnots_cancelled},
+      {"gates_removed",
+        2 * swap_optimizer->swaps_cancelled + 2 * swap_optimizer->cnots_cancelled}
+    };
+  }
+  if (gatemap) {
+    json["detect_cache"] = {
+      {"hits", gatemap->detect_cache_hits},
+      {"misses", gatemap->detect_cache_misses},
+      {"clears", gatemap->detect_cache_clears}
+    };
+    json["detect_index"] = {
+      {"hits", gatemap->detect_index_hits},
+      {"fallbacks", gatemap->detect_index_fallbacks}
+    };
+    json["template_cache"] = {
+      {"hits", gatemap->template_cache_hits},
+      {"misses", gatemap->template_cache_misses},
+      {"clears", gatemap->template_cache_clears}
+    };
+  }
+  return json;
+}
+
+/**
+ * Handles an ArbCmd addressed to this operator, sent either by the host or
+ * by the upstream plugin.
+ */
+dqcs::ArbData MapperPlugin::handle_arb(Downstream &downstream, dqcs::ArbCmd &&cmd) {
+  if (cmd.is_oper("stats")) {
+    dqcs::ArbData data;
+    data.set_arb_json_string(stats_json().dump());
+    return data;
+  } else if (cmd.is_oper("defer_measurements")) {
+    if (cmd.get_arb_arg_count() != 1) {
+      throw std::invalid_argument("Expected one argument for openql_mapper.defer_measurements");
+    }
+    set_defer_measurements(downstream, parse_bool(cmd.get_arb_arg_string(0)));
+    return dqcs::ArbData();
+  } else if (cmd.is_oper("sync")) {
+
+    // Forward the command after flushing. Because arbs are synchronous, this
+    // ensures that the results of all deferred measurements are received
+    // before we return, and it flushes any mappers further downstream.
+    run_mapper(downstream);
+    return forward_arb(downstream, std::move(cmd));
+
+  }
+  throw std::invalid_argument("Unknown command openql_mapper." + cmd.get_oper());
+}
+
+/**
+ * Forwards an ArbCmd that is not addressed to this operator downstream, after
+ * sending any gates that are held back.
+ */
+dqcs::ArbData MapperPlugin::forward_arb(Downstream &downstream, dqcs::ArbCmd &&cmd) {
+  flush_gates(downstream);
+  return downstream.arb(std::move(cmd));
+}
+
+/**
+ * Flushes out any pending operations occurring after the last measurement,
+ * reports the performance counters, and writes the timeline.
+ */
+void MapperPlugin::drop(Downstream &downstream) {
+  {
+    TimelineScope scope("drop");
+    run_mapper(downstream);
+    flush_gates(downstream);
+  }
+
+  // Report the performance counters.
+  std::string json = stats_json().dump(2);
+  DQCSIM_INFO("Performance counters:\n%s", json.c_str());
+  if (!stats_fname.empty()) {
+    std::ofstream ofs(stats_fname);
+    ofs << json << std::endl;
+    if (!ofs) {
+      DQCSIM_ERROR("Failed to write performance counters to %s", stats_fname.c_str());
+    }
+  }
+
+  // Write the timeline.
+  if (!timeline_fname.empty() && !Timeline::write(timeline_fname)) {
+    DQCSIM_ERROR("Failed to write timeline to %s", timeline_fname.c_str());
+  }
+}
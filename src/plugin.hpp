@@ -0,0 +1,607 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <dqcsim>
+#include <openql.h>
+#include "allocator.hpp"
+#include "bimap.hpp"
+#include "gates.hpp"
+#include "kernel_cache.hpp"
+#include "peephole.hpp"
+#include "placement.hpp"
+#include "session.hpp"
+#include "snapshot.hpp"
+#include "stats.hpp"
+#include "swap_optimizer.hpp"
+#include "timeline.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
+
+/**
+ * Interface to whatever is downstream of the operator. In the operator
+ * executable this is just a wrapper around DQCsim's plugin state, but having
+ * this interface allows the operator logic to be driven without a DQCsim
+ * simulation, for instance for benchmarking.
+ */
+class Downstream {
+public:
+  virtual ~Downstream() = default;
+
+  /**
+   * Allocates the given number of downstream qubits.
+   */
+  virtual void allocate(size_t num_qubits) = 0;
+
+  /**
+   * Sends a gate downstream.
+   */
+  virtual void gate(dqcsim::wrap::Gate &&gate) = 0;
+
+  /**
+   * Returns the latest measurement result for the given downstream qubit.
+   */
+  virtual dqcsim::wrap::Measurement get_measurement(const dqcsim::wrap::QubitRef &qubit) = 0;
+
+  /**
+   * Sends an ArbCmd downstream, returning its result.
+   */
+  virtual dqcsim::wrap::ArbData arb(dqcsim::wrap::ArbCmd &&cmd) = 0;
+
+  /**
+   * Returns a random number from the simulation's deterministic random
+   * number generator.
+   */
+  virtual uint64_t random() = 0;
+
+};
+
+/**
+ * Metric used to pick the best result when mapping a kernel with multiple
+ * mapper configurations.
+ */
+enum class TrialMetric {
+  // Fewest inserted swaps, then lowest depth.
+  Swaps,
+
+  // Lowest depth, then fewest inserted swaps.
+  Depth
+};
+
+/**
+ * Configuration for the operator, normally taken from the environment and
+ * the initialization ArbCmds.
+ */
+class MapperConfig {
+public:
+
+  /**
+   * Filename of the OpenQL hardware configuration JSON file.
+   */
+  std::string platform_json_fname;
+
+  /**
+   * Filename of the DQCsim <-> OpenQL gatemap JSON file.
+   */
+  std::string gatemap_json_fname;
+
+  /**
+   * Filename of a precompiled snapshot of the gatemap and platform topology,
+   * used instead of the gatemap JSON file if set.
+   */
+  std::string snapshot_fname;
+
+  /**
+   * OpenQL options to set (`ql::options::set()`), as key-value pairs.
+   */
+  std::vector<std::pair<std::string, std::string>> options;
+
+  /**
+   * Additional mapper configurations to map each kernel with, each given as
+   * OpenQL options overriding the ones in `options`. Every configuration
+   * also gets its own random seed.
+   */
+  std::vector<std::vector<std::pair<std::string, std::string>>> trials;
+
+  /**
+   * Metric used to pick the best result when there are multiple mapper
+   * configurations.
+   */
+  TrialMetric trial_metric = TrialMetric::Swaps;
+
+  /**
+   * Directory to cache the routing tables of platforms in. Empty disables
+   * the cache.
+   */
+  std::string route_cache_dir;
+
+  /**
+   * Maximum number of qubit exchanges evaluated while improving the greedy
+   * initial placement. Zero just uses the greedy placement.
+   */
+  size_t placement_effort = 1000000;
+
+  /**
+   * Time limit for improving the greedy initial placement, in milliseconds.
+   * Zero means no limit. If the limit is hit, the placement depends on
+   * timing.
+   */
+  size_t placement_budget = 0;
+
+  /**
+   * Maximum number of mapped kernels to cache. Zero disables the cache.
+   */
+  size_t kernel_cache_capacity = 256;
+
+  /**
+   * Maximum number of distinct gates to cache the detection result for. Zero
+   * disables the cache.
+   */
+  size_t detect_cache_capacity = 16384;
+
+  /**
+   * Whether kernels that don't need routing bypass the OpenQL mapper.
+   */
+  bool fast_path = true;
+
+  /**
+   * Whether redundant gates are removed from each kernel before it is
+   * mapped.
+   */
+  bool peephole = false;
+
+  /**
+   * Whether swaps that are immediately undone are removed from the gates
+   * sent downstream, and swaps are folded into adjacent cnots where the
+   * platform decomposes swaps into cnots.
+   */
+  bool swap_cancellation = false;
+
+  /**
+   * Whether swaps are performed by permuting the downstream qubits rather
+   * than by sending swap gates downstream. This is only correct if the
+   * downstream simulator doesn't model the cost or noise of swap gates.
+   */
+  bool virtual_swaps = false;
+
+  /**
+   * Whether consecutive measurements or preps of the same kind on different
+   * qubits are sent downstream as a single gate.
+   */
+  bool coalesce = true;
+
+  /**
+   * Maximum number of gates in a kernel before it is mapped and sent
+   * downstream, even if there was no measurement. Zero means unlimited.
+   */
+  size_t window_gates = 0;
+
+  /**
+   * Maximum circuit depth of a kernel before it is mapped and sent
+   * downstream, even if there was no measurement. Zero means unlimited.
+   */
+  size_t window_depth = 0;
+
+  /**
+   * Whether measurements are queued up like other gates, rather than
+   * immediately flushing the kernel. The results are then sent upstream
+   * asynchronously, when they are received from downstream.
+   */
+  bool defer_measurements = false;
+
+  /**
+   * Whether a measurement only flushes the gates it depends on, leaving the
+   * others queued up.
+   */
+  bool causal_flush = false;
+
+  /**
+   * File to write the performance counters to on drop, if any.
+   */
+  std::string stats_fname;
+
+  /**
+   * File to write the timeline of the plugin callbacks to on drop, if any.
+   * Events are only recorded if this is set.
+   */
+  std::string timeline_fname;
+
+  /**
+   * Whether the qubit map and gates should be dumped with debug verbosity.
+   */
+  bool debug_dumps = false;
+
+  /**
+   * File to record the mapping results to, if any.
+   */
+  std::string record_fname;
+
+  /**
+   * File to replay the mapping results from, if any.
+   */
+  std::string replay_fname;
+
+  /**
+   * Loads the defaults for the configuration from the environment.
+   */
+  void load_env();
+
+  /**
+   * Interprets the given initialization commands. Commands for interfaces
+   * other than openql_mapper are ignored.
+   *
+   * \throws std::invalid_argument when an openql_mapper command is not
+   * recognized or has the wrong number of arguments.
+   */
+  void load_cmds(dqcsim::wrap::ArbCmdQueue &&cmds);
+
+};
+
+/**
+ * Operator plugin for the mapper.
+ */
+class MapperPlugin {
+public:
+
+  // OpenQL platform.
+  std::shared_ptr<ql::quantum_platform> platform;
+
+  // Mapping session, wrapping the OpenQL mapper.
+  MappingSession session;
+
+  // Mapping sessions for the additional mapper configurations that each
+  // kernel is mapped with, if any.
+  std::vector<std::unique_ptr<MappingSession>> trial_sessions;
+
+  // Metric used to pick the best result among the mapper configurations.
+  TrialMetric trial_metric;
+
+  // The gates in the current kernel, using virtual qubit indices, with
+  // multi-qubit-parallel gates split up. The OpenQL kernel is only built from
+  // this when the kernel actually needs to be mapped.
+  std::vector<OpenQLGateDescription> kernel_gates;
+
+  // The virtual to physical placement at the start of the kernel that is
+  // being flushed, indexed by virtual qubit.
+  std::vector<size_t> v2r_in;
+
+  // Scratch space for splitting up multi-qubit-parallel gates, translating
+  // qubit indices, and sending gates downstream, kept around to reuse their
+  // capacity.
+  std::vector<size_t> parallel_qubits;
+  std::vector<size_t> phys_qubits;
+  std::vector<size_t> down_qubits;
+  OpenQLGateDescription send_desc;
+
+  // Number of physical qubits in the platform.
+  size_t num_qubits;
+
+  // Qubit connectivity of the platform.
+  Topology topology;
+
+  // Whether kernels that don't need routing bypass the OpenQL mapper.
+  bool fast_path = true;
+
+  // Peephole optimizer that removes redundant gates from each kernel before
+  // it is mapped, if enabled.
+  std::unique_ptr<Peephole> peephole;
+
+  // Optimizer that cancels and folds the swaps in the gates sent downstream,
+  // if enabled. It holds back gates, possibly across kernels, and works on
+  // downstream qubit indices.
+  std::unique_ptr<SwapOptimizer> swap_optimizer;
+
+  // Whether swaps are performed by permuting the downstream qubits rather
+  // than by sending swap gates downstream.
+  bool virtual_swaps = false;
+
+  // Maps physical qubits to downstream qubits, counting from zero. This is
+  // the identity unless swaps are virtual.
+  std::vector<size_t> phys2down;
+
+  // Whether consecutive measurements or preps of the same kind on different
+  // qubits are sent downstream as a single gate. The gate being built up
+  // that way is held back in coalesced while coalescing is set, and
+  // coalesced_qubits tells which downstream qubits are in it.
+  bool coalesce = true;
+  bool coalescing = false;
+  OpenQLGateDescription coalesced;
+  std::vector<bool> coalesced_qubits;
+
+  // Whether no kernel has been flushed yet, in which case all qubits are
+  // still in their initial state, so the initial placement can be chosen
+  // freely.
+  bool first_kernel = true;
+
+  // Maximum number of qubit exchanges evaluated while improving the initial
+  // placement, and the time limit for doing so in seconds, zero if none.
+  size_t placement_effort;
+  double placement_budget;
+
+  // Maximum number of gates and circuit depth of a kernel before it is
+  // flushed without waiting for a measurement. Zero means unlimited.
+  size_t window_gates = 0;
+  size_t window_depth = 0;
+
+  // Circuit depth of the current kernel, in total and per virtual qubit.
+  // Only tracked when window_depth is nonzero.
+  size_t kernel_depth = 0;
+  std::vector<size_t> qubit_depth;
+
+  // Whether measurements are queued up like other gates, rather than
+  // immediately flushing the kernel.
+  bool defer_measurements = false;
+
+  // Whether a measurement only flushes the gates it depends on.
+  bool causal_flush = false;
+
+  // Scratch space for splitting the causal cone of a measurement off the
+  // current kernel: whether each virtual qubit and each gate is in the cone,
+  // and the gates that are not, kept around to reuse their capacity.
+  std::vector<bool> cone_qubits;
+  std::vector<bool> cone_gates;
+  std::vector<OpenQLGateDescription> buffered_gates;
+
+  // Number of deferred measurements in the current kernel, and whether it
+  // contains a swap gate received from upstream. We don't allow a kernel to
+  // contain both, because we can't tell the swaps inserted by the mapper
+  // apart from those received from upstream, and we need to track the former
+  // to figure out which qubit a measurement in the mapped kernel belongs to.
+  size_t kernel_deferred = 0;
+  bool kernel_has_swap = false;
+
+  // For each virtual qubit, the upstream qubits of the deferred measurements
+  // on it in the current kernel, in program order.
+  std::vector<std::deque<size_t>> pending_measures;
+
+  // Maps the physical qubits at the current point in the emitted mapped
+  // kernel to virtual qubits, by following the swaps inserted by the mapper.
+  std::vector<size_t> emit_loc;
+
+  // For each downstream qubit, the upstream qubits of the deferred
+  // measurements on it that were sent downstream, but for which we haven't
+  // received the result yet, in order.
+  std::vector<std::deque<size_t>> awaiting_measures;
+
+  // Map from DQCsim gates to OpenQL gate descriptions and back.
+  std::shared_ptr<OpenQLGateMap> gatemap;
+
+  // Map from DQCsim qubits to OpenQL qubits.
+  QubitBiMap dqcs2virt;
+
+  // Allocator for the OpenQL virtual qubits mapped to in dqcs2virt.
+  QubitAllocator virt_alloc;
+
+  // Number of upstream qubits allocated so far.
+  size_t dqcs_nq = 0;
+
+  // Map from OpenQL virtual qubits to OpenQL physical qubits. The mapping
+  // session takes this as the placement at the start of each kernel, and
+  // this map is updated to the placement it returns.
+  QubitBiMap virt2phys;
+
+  // Cache for the mapping results of recently mapped kernels.
+  KernelCache kernel_cache;
+
+  // Trace that the mapping results are recorded to, if any.
+  std::unique_ptr<TraceWriter> trace_writer;
+
+  // Trace that the mapping results are replayed from, if any. Reset when
+  // the trace diverges from the current run.
+  std::unique_ptr<TraceReader> trace_reader;
+
+  // The last mapping result read from the replay trace.
+  KernelCache::Entry replayed;
+
+  // Performance counters.
+  MapperStats stats;
+
+  // File to write the performance counters to on drop, if any.
+  std::string stats_fname;
+
+  // File to write the timeline of the plugin callbacks to on drop, if any.
+  std::string timeline_fname;
+
+  // Whether the qubit map and gates should be dumped with debug verbosity.
+  // Building these dumps is expensive, and DQCsim doesn't tell us whether
+  // debug messages will actually be shown, so this is opt-in.
+  bool debug_dumps = false;
+
+  /**
+   * Starts a new kernel, representing a new measurement-delimited block.
+   */
+  void new_kernel();
+
+  /**
+   * Initializes the operator with the given configuration.
+   */
+  void initialize(Downstream &downstream, const MapperConfig &config);
+
+  /**
+   * Allocates the given upstream qubits.
+   *
+   * DQCsim supports allocating and freeing qubits at will, but obviously a
+   * physical platform doesn't. The trivial solution would be to just error
+   * out on the N+1'th qubit allocation, but we can do better than that when
+   * there are deallocations as well by reusing qubits that were freed. That's
+   * what the dqcs2virt bimap is used for; mapping the upstream DQCsim qubit
+   * references to virtual qubits in OpenQL. When qubits aren't freed until
+   * the end of the program (or are never freed), the OpenQL virtual qubit
+   * index will just be the DQCsim index, minus one because DQCsim starts
+   * counting at one.
+   */
+  void allocate(Downstream &downstream, dqcsim::wrap::QubitSet &&qubits);
+
+  /**
+   * Frees the given upstream qubits. Inverse of `allocate()`.
+   */
+  void free(Downstream &downstream, dqcsim::wrap::QubitSet &&qubits);
+
+  /**
+   * Dumps the current qubit map with debug verbosity.
+   */
+  void dump_qubit_map();
+
+  /**
+   * Dumps a gate with debug verbosity.
+   */
+  void dump_gate(
+    const std::string &prefix,
+    const std::string &qubit_type,
+    const OpenQLGateDescription &desc);
+
+  /**
+   * Prepares for sending the gates of the current kernel downstream. Must be
+   * called before the qubit placement is updated.
+   */
+  void begin_emit();
+
+  /**
+   * Sends a gate on the given physical qubits downstream, through the swap
+   * optimizer if enabled.
+   */
+  void send_gate(
+    Downstream &downstream,
+    size_t id,
+    const std::vector<size_t> &phys_qubits,
+    double angle);
+
+  /**
+   * Actually sends a gate on the given downstream qubits, counting from
+   * zero, downstream.
+   */
+  void emit_gate(
+    Downstream &downstream,
+    size_t id,
+    const std::vector<size_t> &down_qubits,
+    double angle);
+
+  /**
+   * Constructs the DQCsim gate for the given gate on downstream qubits.
+   */
+  dqcsim::wrap::Gate construct(const OpenQLGateDescription &desc);
+
+  /**
+   * Sends the gates held back by the swap optimizer downstream. Must be
+   * called before anything but a measurement could observe the downstream
+   * state.
+   */
+  void flush_gates(Downstream &downstream);
+
+  /**
+   * Sends the measurement or prep gate that is being coalesced downstream,
+   * if any.
+   */
+  void flush_coalesced(Downstream &downstream);
+
+  /**
+   * Returns whether all gates in the current kernel can be executed without
+   * routing, given the current placement; that is, whether they're all
+   * single-qubit gates or two-qubit gates acting on adjacent physical qubits.
+   */
+  bool kernel_is_executable() const;
+
+  /**
+   * Returns whether mapping result a is better than b according to the
+   * configured trial metric.
+   */
+  bool trial_is_better(
+    const MappingSession::Result &a,
+    const MappingSession::Result &b) const;
+
+  /**
+   * This function runs the mapper for the gates queued up thus far and sends
+   * the mapped gates downstream.
+   */
+  void run_mapper(Downstream &downstream);
+
+  /**
+   * Maps and sends downstream only the gates in the causal cone of the gates
+   * in the current kernel starting at the given index, that is, those gates
+   * and the gates they depend on through their qubits. The other gates are
+   * left in the kernel. They commute with the ones in the cone, and they use
+   * virtual qubit indices, so they can simply be mapped later, starting from
+   * the placement the cone leaves behind.
+   */
+  void flush_cone(Downstream &downstream, size_t first);
+
+  /**
+   * Changes whether measurements are deferred. The current kernel is flushed
+   * when measurements are no longer deferred.
+   */
+  void set_defer_measurements(Downstream &downstream, bool defer);
+
+  /**
+   * Updates the circuit depth of the current kernel for a gate added on the
+   * given virtual qubits.
+   */
+  void track_depth(const std::vector<size_t> &qubits);
+
+  /**
+   * Returns whether the current kernel has reached the configured gate count
+   * or depth window, and should thus be flushed.
+   */
+  bool window_full() const;
+
+  /**
+   * Handles a gate received from upstream, returning the measurement results
+   * to send upstream.
+   *
+   * Measurement gates must be forwarded immediately, but we can queue
+   * everything else up in the circuit. With causal flushing, only the gates
+   * that the measurement depends on are forwarded along with it. To bound
+   * memory usage and latency for long circuits without measurements, the
+   * queue is also flushed when it fills up the configured window. The qubit
+   * placement resulting from mapping one window simply carries over into the
+   * next.
+   *
+   * When measurements are deferred, measurement gates are queued up as well,
+   * and the results are returned by `modify_measurement()` when they arrive
+   * from downstream instead.
+   */
+  dqcsim::wrap::MeasurementSet gate(Downstream &downstream, dqcsim::wrap::Gate &&gate);
+
+  /**
+   * Handles a measurement result received from downstream, returning the
+   * measurement results to send upstream. Only results for deferred
+   * measurements are sent upstream this way; the others were already
+   * returned by `gate()`.
+   */
+  dqcsim::wrap::MeasurementSet modify_measurement(dqcsim::wrap::Measurement &&measurement);
+
+  /**
+   * Returns the performance counters of the operator and its caches as a JSON
+   * object.
+   */
+  nlohmann::json stats_json() const;
+
+  /**
+   * Handles an ArbCmd addressed to this operator, sent either by the host or
+   * by the upstream plugin. Supported commands:
+   *
+   *  - openql_mapper.stats: returns the performance counters as a JSON
+   *    object.
+   *  - openql_mapper.defer_measurements: expects a single string argument,
+   *    "yes" or "no", changing whether measurements are deferred from this
+   *    point onward.
+   *  - openql_mapper.sync: maps and sends all queued gates downstream, and
+   *    then forwards the command downstream.
+   */
+  dqcsim::wrap::ArbData handle_arb(Downstream &downstream, dqcsim::wrap::ArbCmd &&cmd);
+
+  /**
+   * Forwards an ArbCmd that is not addressed to this operator downstream,
+   * after sending any gates that are held back.
+   */
+  dqcsim::wrap::ArbData forward_arb(Downstream &downstream, dqcsim::wrap::ArbCmd &&cmd);
+
+  /**
+   * Flushes out any pending operations occurring after the last measurement,
+   * reports the performance counters, and writes the timeline.
+   */
+  void drop(Downstream &downstream);
+
+};
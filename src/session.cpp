@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <session.hpp>
+#include <timeline.hpp>
+
+/**
+ * Returns the lock protecting OpenQL's global state.
+ */
+std::mutex &MappingSession::global_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+/**
+ * Sets the given global OpenQL option, unless it was already set to the
+ * given value. Must be called with the global lock held.
+ */
+void MappingSession::apply_option(const std::string &key, const std::string &value) {
+  static std::unordered_map<std::string, std::string> applied;
+  auto it = applied.find(key);
+  if (it != applied.end() && it->second == value) {
+    return;
+  }
+  ql::options::set(key, value);
+  applied[key] = value;
+}
+
+/**
+ * Sets an OpenQL option for this session. If the option was already set,
+ * its value is replaced.
+ */
+void MappingSession::set_option(const std::string &key, const std::string &value) {
+  for (auto &option : options) {
+    if (option.first == key) {
+      option.second = value;
+      return;
+    }
+  }
+  options.emplace_back(key, value);
+}
+
+/**
+ * Applies the options of this session to OpenQL's global state.
+ */
+void MappingSession::apply_options() {
+  std::lock_guard<std::mutex> lock(global_mutex());
+  for (const auto &option : options) {
+    apply_option(option.first, option.second);
+  }
+}
+
+/**
+ * Returns the current value of the given global OpenQL option.
+ */
+std::string MappingSession::get_option(const std::string &key) {
+  std::lock_guard<std::mutex> lock(global_mutex());
+  return ql::options::get(key);
+}
+
+/**
+ * Initializes the mapper for the given platform and gatemap.
+ */
+void MappingSession::init(
+  const std::shared_ptr<ql::quantum_platform> &platform,
+  const std::shared_ptr<OpenQLGateMap> &gatemap
+) {
+  this->platform = platform;
+  this->gatemap = gatemap;
+
+  // Note that this seeds the mapper's private random generator with the
+  // current timestamp. Use seed() afterwards to make mapping reproducible.
+  std::lock_guard<std::mutex> lock(global_mutex());
+  mapper.Init(*platform);
+}
+
+/**
+ * Seeds the random number generator used by the mapper.
+ */
+void MappingSession::seed(uint64_t seed) {
+  mapper.gen.seed((std::mt19937::result_type)(seed ^ (seed >> 32)));
+}
+
+/**
+ * Maps the given gates, using virtual qubit indices, starting from the
+ * given virtual to physical placement.
+ */
+MappingSession::Result MappingSession::map(
+  const std::vector<OpenQLGateDescription> &gates,
+  const std::vector<size_t> &v2r_in
+) {
+
+  // Build the OpenQL kernel. The mapper can't be given an input placement,
+  // so we build it with physical qubit indices instead, and let the mapper
+  // assume a one-to-one initial placement.
+  ql::quantum_kernel kernel(
+    "kernel_" + std::to_string(kernel_counter),
+    *platform, platform->qubit_number);
+  kernel_counter++;
+  for (const OpenQLGateDescription &desc : gates) {
+    phys_qubits.clear();
+    for (size_t virt : desc.qubits) {
+      phys_qubits.push_back(v2r_in[virt]);
+    }
+    kernel.gate(gatemap->get_name(desc.id), phys_qubits, {}, 0, desc.angle);
+  }
+
+  // Run the mapper with our options.
+  {
+    std::lock_guard<std::mutex> lock(global_mutex());
+    for (const auto &option : options) {
+      apply_option(option.first, option.second);
+    }
+
+    // The placement must be one-to-one, as explained above. Initial
+    // placement is done by the operator itself.
+    apply_option("mapinitone2one", "yes");
+    apply_option("initialplace", "no");
+
+    // Don't insert prep gates automatically; let the upstream plugin handle
+    // that. DQCsim currently doesn't really support prep gates anyway (they're
+    // implemented as a measurement followed by a conditional X).
+    apply_option("mapassumezeroinitstate", "yes");
+
+    TimelineScope scope("mapper.Map");
+    mapper.Map(kernel);
+  }
+
+  // Convert the mapped gates. This is the only place where we need to look
+  // up gates by name.
+  Result result;
+  result.gates.reserve(kernel.c.size());
+  qubit_depth.assign(platform->qubit_number, 0);
+  for (ql::gate *ql_gate : kernel.c) {
+    OpenQLGateDescription desc;
+    desc.id = gatemap->get_id(ql_gate->name);
+    desc.angle = ql_gate->angle;
+    desc.qubits = ql_gate->operands;
+    desc.multi_qubit_parallel = false;
+
+    // Each gate starts after the last gate on any of its qubits.
+    size_t depth = 0;
+    for (size_t phys : desc.qubits) {
+      if (phys < qubit_depth.size()) {
+        depth = std::max(depth, qubit_depth[phys]);
+      }
+    }
+    depth++;
+    for (size_t phys : desc.qubits) {
+      if (phys < qubit_depth.size()) {
+        qubit_depth[phys] = depth;
+      }
+    }
+    result.depth = std::max(result.depth, depth);
+
+    result.gates.push_back(std::move(desc));
+  }
+
+  // Take the number of inserted swaps from the mapper itself. Counting swap
+  // gates in its output would miss swaps that the platform decomposes into
+  // other gates.
+  result.swaps_inserted = mapper.nswapsadded;
+
+  // Compose the input placement with the permutation applied by the mapper
+  // to get the output placement.
+  result.v2r_out.resize(v2r_in.size());
+  for (size_t virt = 0; virt < v2r_in.size(); virt++) {
+    size_t phys = v2r_in[virt];
+    if (phys < mapper.v2r_out.size()) {
+      result.v2r_out[virt] = mapper.v2r_out[phys];
+    } else {
+      result.v2r_out[virt] = (size_t)-1;
+    }
+  }
+
+  return result;
+}
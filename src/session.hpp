@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <openql.h>
+#include "gates.hpp"
+
+/**
+ * A mapping session, wrapping the OpenQL mapper for a single platform.
+ *
+ * The session owns the OpenQL options used for mapping, and takes the qubit
+ * placement at the start of each kernel as an input, returning the placement
+ * at the end. The caller thus only deals with virtual qubit indices.
+ *
+ * Internally, OpenQL still reads its options from process-wide state, and its
+ * mapper can only start from a one-to-one placement. The session hides this
+ * by building the OpenQL kernel with physical qubit indices, and by only
+ * setting the global options that differ from what was last set, while
+ * holding a process-wide lock for the duration of the mapping. Multiple
+ * sessions can thus coexist in one process, but their mapper invocations are
+ * serialized.
+ */
+class MappingSession {
+public:
+
+  /**
+   * Result of mapping a kernel.
+   */
+  class Result {
+  public:
+
+    /**
+     * The mapped gates, using physical qubit indices.
+     */
+    std::vector<OpenQLGateDescription> gates;
+
+    /**
+     * The virtual to physical placement at the end of the kernel, indexed by
+     * virtual qubit.
+     */
+    std::vector<size_t> v2r_out;
+
+    /**
+     * Number of swaps inserted by the mapper, including moves, whether they
+     * were sent as swap gates or decomposed.
+     */
+    size_t swaps_inserted = 0;
+
+    /**
+     * Circuit depth of the mapped gates, counting each gate as one cycle.
+     */
+    size_t depth = 0;
+
+  };
+
+private:
+
+  // OpenQL platform.
+  std::shared_ptr<ql::quantum_platform> platform;
+
+  // Map from DQCsim gates to OpenQL gate descriptions and back.
+  std::shared_ptr<OpenQLGateMap> gatemap;
+
+  // OpenQL mapper.
+  Mapper mapper;
+
+  // OpenQL options to use when mapping, as key-value pairs.
+  std::vector<std::pair<std::string, std::string>> options;
+
+  // Kernel counter, for generating unique names.
+  size_t kernel_counter = 0;
+
+  // Scratch space for translating gate operands.
+  std::vector<size_t> phys_qubits;
+
+  // Scratch space for computing the depth of the mapped circuit, indexed by
+  // physical qubit.
+  std::vector<size_t> qubit_depth;
+
+  /**
+   * Returns the lock protecting OpenQL's global state.
+   */
+  static std::mutex &global_mutex();
+
+  /**
+   * Sets the given global OpenQL option, unless it was already set to the
+   * given value. Must be called with the global lock held.
+   */
+  static void apply_option(const std::string &key, const std::string &value);
+
+public:
+
+  /**
+   * Sets an OpenQL option for this session. If the option was already set,
+   * its value is replaced.
+   */
+  void set_option(const std::string &key, const std::string &value);
+
+  /**
+   * Returns the OpenQL options of this session, as key-value pairs.
+   */
+  const std::vector<std::pair<std::string, std::string>> &get_options() const {
+    return options;
+  }
+
+  /**
+   * Applies the options of this session to OpenQL's global state. This is
+   * needed for options that affect more than just the mapper, such as
+   * logging, before loading the platform.
+   */
+  void apply_options();
+
+  /**
+   * Returns the current value of the given global OpenQL option.
+   */
+  static std::string get_option(const std::string &key);
+
+  /**
+   * Initializes the mapper for the given platform and gatemap.
+   */
+  void init(
+    const std::shared_ptr<ql::quantum_platform> &platform,
+    const std::shared_ptr<OpenQLGateMap> &gatemap);
+
+  /**
+   * Seeds the random number generator used by the mapper.
+   */
+  void seed(uint64_t seed);
+
+  /**
+   * Maps the given gates, using virtual qubit indices, starting from the
+   * given virtual to physical placement.
+   */
+  Result map(
+    const std::vector<OpenQLGateDescription> &gates,
+    const std::vector<size_t> &v2r_in);
+
+};
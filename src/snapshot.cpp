@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <snapshot.hpp>
+
+// Alias the dqcsim::wrap namespace to something shorter.
+namespace dqcs = dqcsim::wrap;
+
+// Magic number and version at the start of each snapshot file.
+static const char SNAPSHOT_MAGIC[8] = {'D', 'Q', 'C', 'S', 'O', 'M', 'S', 'N'};
+static const uint32_t SNAPSHOT_VERSION = 2;
+
+/**
+ * Rounds the given offset up to a multiple of 8 bytes.
+ */
+static uint64_t align(uint64_t offset) {
+  return (offset + 7) & ~(uint64_t)7;
+}
+
+/**
+ * Memory-maps the given snapshot file and validates it.
+ */
+Snapshot::Snapshot(const std::string &fname) : fname(fname) {
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open snapshot file " + fname);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("Failed to stat snapshot file " + fname);
+  }
+  size = st.st_size;
+  if (size < sizeof(Header)) {
+    close(fd);
+    throw std::runtime_error(fname + " is not a mapper snapshot file");
+  }
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error("Failed to map snapshot file " + fname);
+  }
+  data = static_cast<const char*>(mapping);
+  try {
+    validate();
+  } catch (...) {
+    munmap(const_cast<char*>(data), size);
+    throw;
+  }
+}
+
+Snapshot::~Snapshot() {
+  munmap(const_cast<char*>(data), size);
+}
+
+/**
+ * Checks that the file is a valid snapshot.
+ */
+void Snapshot::validate() const {
+  const Header &h = header();
+  if (!std::equal(h.magic, h.magic + sizeof(h.magic), SNAPSHOT_MAGIC)) {
+    throw std::runtime_error(fname + " is not a mapper snapshot file");
+  }
+  if (h.version != SNAPSHOT_VERSION) {
+    throw std::runtime_error(fname + " has an unsupported snapshot version");
+  }
+  if (h.size != size) {
+    throw std::runtime_error(fname + " is truncated");
+  }
+
+  // Check that all sections lie within the file and are aligned.
+  if (h.num_gates > size || h.matrices_size > size || h.num_qubits >= 0xFFFF) {
+    throw std::runtime_error(fname + " is corrupt");
+  }
+  uint64_t n = h.num_qubits;
+  uint64_t row_words = (n + 63) / 64;
+  struct {
+    uint64_t offset;
+    uint64_t size;
+  } sections[] = {
+    {h.gates_offset, h.num_gates * sizeof(Gate)},
+    {h.names_offset, h.names_size},
+    {h.matrices_offset, h.matrices_size * sizeof(dqcs::complex)},
+    {h.adjacency_offset, n * row_words * sizeof(uint64_t)},
+    {h.distances_offset, n * n * sizeof(uint16_t)}
+  };
+  for (const auto &sec : sections) {
+    if (sec.offset % 8 || sec.offset < sizeof(Header) || sec.offset > size || sec.size > size - sec.offset) {
+      throw std::runtime_error(fname + " is corrupt");
+    }
+  }
+
+  // Check the gate records.
+  const Gate *gates = section<Gate>(h.gates_offset);
+  for (size_t id = 0; id < h.num_gates; id++) {
+    const Gate &gate = gates[id];
+    if (gate.name_offset > h.names_size || gate.name_length > h.names_size - gate.name_offset) {
+      throw std::runtime_error(fname + " is corrupt");
+    }
+    if (gate.kind > (uint8_t)OpenQLGateSpec::Kind::Predefined
+      || gate.predefined > (uint16_t)dqcs::PredefinedGate::SqSwap
+      || gate.matrix_qubits > 16
+    ) {
+      throw std::runtime_error(fname + " is corrupt");
+    }
+    uint64_t entries = gate.matrix_qubits ? (uint64_t)1 << (2 * gate.matrix_qubits) : 0;
+    if (gate.matrix_offset > h.matrices_size || entries > h.matrices_size - gate.matrix_offset) {
+      throw std::runtime_error(fname + " is corrupt");
+    }
+  }
+}
+
+/**
+ * Writes a snapshot of the given gatemap and topology to the given file.
+ * The routing tables of the topology must have been computed. The file is
+ * replaced atomically, so operators that have the old snapshot loaded
+ * keep seeing the old contents.
+ */
+void Snapshot::write(
+  const std::string &fname,
+  const OpenQLGateMap &gatemap,
+  const Topology &topology
+) {
+  const std::vector<OpenQLGateSpec> &specs = gatemap.get_specs();
+  size_t n = topology.size();
+
+  // Build the gate records and the name and matrix sections.
+  std::vector<Gate> gates;
+  std::string names;
+  std::vector<dqcs::complex> matrices;
+  for (const OpenQLGateSpec &spec : specs) {
+    Gate gate;
+    std::memset(&gate, 0, sizeof(gate));
+    gate.name_offset = names.size();
+    gate.name_length = spec.name.size();
+    gate.kind = (uint8_t)spec.kind;
+    gate.has_angle = spec.has_angle;
+    gate.predefined = (uint16_t)spec.predefined;
+    gate.controlled = spec.controlled;
+    gate.matrix_qubits = spec.matrix_qubits;
+    gate.matrix_offset = matrices.size();
+    names += spec.name;
+    matrices.insert(matrices.end(), spec.matrix.begin(), spec.matrix.end());
+    gates.push_back(gate);
+  }
+
+  // Lay out the file.
+  Header h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+  h.version = SNAPSHOT_VERSION;
+  h.num_qubits = n;
+  h.topology_hash = topology.get_hash();
+  h.epsilon = gatemap.get_epsilon();
+  h.num_gates = gates.size();
+  h.names_size = names.size();
+  h.matrices_size = matrices.size();
+  h.gates_offset = align(sizeof(Header));
+  h.names_offset = align(h.gates_offset + gates.size() * sizeof(Gate));
+  h.matrices_offset = align(h.names_offset + names.size());
+  h.adjacency_offset = align(h.matrices_offset + matrices.size() * sizeof(dqcs::complex));
+  h.distances_offset = align(h.adjacency_offset + topology.get_adjacency().size() * sizeof(uint64_t));
+  h.size = align(h.distances_offset + n * n * sizeof(uint16_t));
+
+  // Write it.
+  std::string buf(h.size, '\0');
+  std::memcpy(&buf[0], &h, sizeof(h));
+  std::memcpy(&buf[h.gates_offset], gates.data(), gates.size() * sizeof(Gate));
+  std::memcpy(&buf[h.names_offset], names.data(), names.size());
+  std::memcpy(&buf[h.matrices_offset], matrices.data(), matrices.size() * sizeof(dqcs::complex));
+  std::memcpy(
+    &buf[h.adjacency_offset], topology.get_adjacency().data(),
+    topology.get_adjacency().size() * sizeof(uint64_t));
+  std::memcpy(&buf[h.distances_offset], topology.get_distances(), n * n * sizeof(uint16_t));
+
+  // Write to a temporary file first and then rename it over the target.
+  // Running operators may have the old snapshot mapped, and overwriting it
+  // in place would change the data under their feet.
+  std::string tmp_fname = fname + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream ofs(tmp_fname, std::ios::binary);
+    ofs.write(buf.data(), buf.size());
+    ofs.close();
+    if (!ofs) {
+      std::remove(tmp_fname.c_str());
+      throw std::runtime_error("Failed to write snapshot file " + fname);
+    }
+  }
+  if (std::rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+    std::remove(tmp_fname.c_str());
+    throw std::runtime_error("Failed to write snapshot file " + fname);
+  }
+}
+
+/**
+ * Returns the parsed gatemap entries, indexed by gate ID.
+ */
+std::vector<OpenQLGateSpec> Snapshot::get_specs() const {
+  const Header &h = header();
+  const Gate *gates = section<Gate>(h.gates_offset);
+  const char *names = section<char>(h.names_offset);
+  const dqcs::complex *matrices = section<dqcs::complex>(h.matrices_offset);
+  std::vector<OpenQLGateSpec> specs(h.num_gates);
+  for (size_t id = 0; id < h.num_gates; id++) {
+    const Gate &gate = gates[id];
+    OpenQLGateSpec &spec = specs[id];
+    spec.name.assign(names + gate.name_offset, gate.name_length);
+    spec.kind = (OpenQLGateSpec::Kind)gate.kind;
+    spec.has_angle = gate.has_angle;
+    spec.predefined = (dqcs::PredefinedGate)gate.predefined;
+    spec.controlled = gate.controlled;
+    spec.matrix_qubits = gate.matrix_qubits;
+    if (gate.matrix_qubits) {
+      const dqcs::complex *matrix = matrices + gate.matrix_offset;
+      spec.matrix.assign(matrix, matrix + ((size_t)1 << (2 * gate.matrix_qubits)));
+    }
+  }
+  return specs;
+}
+
+/**
+ * Checks that the snapshot was compiled for the given topology.
+ */
+void Snapshot::check_topology(const Topology &topology) const {
+  const Header &h = header();
+  const std::vector<uint64_t> &adjacency = topology.get_adjacency();
+  if (h.num_qubits != topology.size()
+    || h.topology_hash != topology.get_hash()
+    || !std::equal(adjacency.begin(), adjacency.end(), section<uint64_t>(h.adjacency_offset))
+  ) {
+    throw std::runtime_error(fname + " was compiled for a different platform topology");
+  }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "gates.hpp"
+#include "topology.hpp"
+
+/**
+ * Precompiled snapshot of a gatemap and platform topology, including the
+ * routing tables.
+ *
+ * A snapshot is written by the dqcsopopenql-mapper-snapshot tool and memory
+ * mapped read-only by the operator at initialization, so startup doesn't
+ * need to parse and validate the gatemap JSON or compute the routing tables,
+ * and concurrent operator processes share the pages of the tables. The
+ * OpenQL platform itself is still loaded from the hardware configuration
+ * file, because the OpenQL mapper needs it; the snapshot is checked against
+ * its topology.
+ *
+ * The file starts with a fixed-size header, followed by 8-byte aligned
+ * sections for the gate records, their names, their matrices, the adjacency
+ * matrix, and the distance table. All integers are stored in
+ * native byte order, so snapshots are not portable between architectures.
+ */
+class Snapshot {
+private:
+
+  /**
+   * Header of a snapshot file.
+   */
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_qubits;
+    uint64_t topology_hash;
+    double epsilon;
+    uint64_t num_gates;
+    uint64_t gates_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t matrices_offset;
+    uint64_t matrices_size;
+    uint64_t adjacency_offset;
+    uint64_t distances_offset;
+    uint64_t size;
+  };
+
+  /**
+   * Gate record in a snapshot file. Offsets are relative to the start of
+   * the respective section, in bytes for names and in complex entries for
+   * matrices.
+   */
+  struct Gate {
+    uint64_t name_offset;
+    uint32_t name_length;
+    uint8_t kind;
+    uint8_t has_angle;
+    uint16_t predefined;
+    uint32_t controlled;
+    uint32_t matrix_qubits;
+    uint64_t matrix_offset;
+  };
+
+  /**
+   * Name of the snapshot file, for error messages.
+   */
+  std::string fname;
+
+  /**
+   * The memory-mapped file.
+   */
+  const char *data = nullptr;
+  size_t size = 0;
+
+  /**
+   * Returns a pointer to the given section of the file.
+   */
+  template <typename T>
+  const T *section(uint64_t offset) const {
+    return reinterpret_cast<const T*>(data + offset);
+  }
+
+  /**
+   * Returns the header of the file.
+   */
+  const Header &header() const {
+    return *section<Header>(0);
+  }
+
+  /**
+   * Checks that the file is a valid snapshot.
+   *
+   * \throws std::runtime_error when it is not.
+   */
+  void validate() const;
+
+public:
+
+  /**
+   * Memory-maps the given snapshot file and validates it.
+   *
+   * \throws std::runtime_error when the file could not be opened or is not
+   * a valid snapshot.
+   */
+  Snapshot(const std::string &fname);
+
+  Snapshot(const Snapshot&) = delete;
+  Snapshot &operator=(const Snapshot&) = delete;
+
+  ~Snapshot();
+
+  /**
+   * Writes a snapshot of the given gatemap and topology to the given file.
+   * The routing tables of the topology must have been computed. The file is
+   * replaced atomically, so operators that have the old snapshot loaded
+   * keep seeing the old contents.
+   *
+   * \throws std::runtime_error when the file could not be written.
+   */
+  static void write(
+    const std::string &fname,
+    const OpenQLGateMap &gatemap,
+    const Topology &topology);
+
+  /**
+   * Returns the number of qubits of the platform.
+   */
+  size_t num_qubits() const {
+    return header().num_qubits;
+  }
+
+  /**
+   * Returns the matrix detection accuracy of the gatemap.
+   */
+  double get_epsilon() const {
+    return header().epsilon;
+  }
+
+  /**
+   * Returns the parsed gatemap entries, indexed by gate ID.
+   */
+  std::vector<OpenQLGateSpec> get_specs() const;
+
+  /**
+   * Checks that the snapshot was compiled for the given topology.
+   *
+   * \throws std::runtime_error when it was not.
+   */
+  void check_topology(const Topology &topology) const;
+
+  /**
+   * Returns the distance table, as a row-major matrix.
+   */
+  const uint16_t *get_distances() const {
+    return section<uint16_t>(header().distances_offset);
+  }
+
+};
@@ -0,0 +1,49 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <snapshot.hpp>
+
+/**
+ * Compiles a hardware configuration and gatemap into a snapshot that the
+ * operator can load through openql_mapper.snapshot instead of the gatemap.
+ */
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    fprintf(stderr,
+      "Usage: %s <hardware_config.json> <gatemap.json> <snapshot>\n"
+      "\n"
+      "Compiles the gatemap and the platform topology (including its routing\n"
+      "tables) into a binary snapshot, for use with openql_mapper.snapshot or\n"
+      "DQCSIM_OPENQL_SNAPSHOT.\n",
+      argv[0]);
+    return 1;
+  }
+  try {
+
+    // Load the topology from the hardware configuration file.
+    std::ifstream ifs(argv[1]);
+    if (!ifs) {
+      throw std::runtime_error(std::string("Failed to open ") + argv[1]);
+    }
+    nlohmann::json platform = nlohmann::json::parse(ifs);
+    size_t num_qubits = platform.at("hardware_settings").at("qubit_number");
+    nlohmann::json topology_json = nlohmann::json::object();
+    auto it = platform.find("topology");
+    if (it != platform.end()) {
+      topology_json = *it;
+    }
+    Topology topology(topology_json, num_qubits);
+    topology.compute_routes("");
+
+    // Load the gatemap. The epsilon value must match the one used by the
+    // operator.
+    OpenQLGateMap gatemap(std::string(argv[2]), 1.0e-6);
+
+    Snapshot::write(argv[3], gatemap, topology);
+
+  } catch (const std::exception &e) {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
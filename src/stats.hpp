@@ -0,0 +1,216 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <json.h>
+
+/**
+ * Accumulates the wall-clock time spent in a scope into a counter.
+ */
+class ScopedTimer {
+private:
+  double &counter;
+  std::chrono::steady_clock::time_point start;
+
+public:
+
+  /**
+   * Starts timing, adding the elapsed time in seconds to the given counter
+   * when the timer goes out of scope.
+   */
+  ScopedTimer(double &counter)
+    : counter(counter), start(std::chrono::steady_clock::now())
+  {
+  }
+
+  ~ScopedTimer() {
+    counter += std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  }
+
+};
+
+/**
+ * Performance counters for the operator.
+ */
+class MapperStats {
+public:
+
+  /**
+   * Number of gates received from upstream.
+   */
+  size_t gates_in = 0;
+
+  /**
+   * Number of gates sent downstream.
+   */
+  size_t gates_out = 0;
+
+  /**
+   * Number of measurements and preps that were sent downstream as part of
+   * the preceding one.
+   */
+  size_t gates_coalesced = 0;
+
+  /**
+   * Number of swap gates inserted by the mapper.
+   */
+  size_t swaps_inserted = 0;
+
+  /**
+   * Number of swap gates that were performed by permuting the downstream
+   * qubits instead of being sent downstream.
+   */
+  size_t swaps_virtual = 0;
+
+  /**
+   * Number of measurements that were deferred.
+   */
+  size_t measurements_deferred = 0;
+
+  /**
+   * Number of kernels that were mapped by invoking the OpenQL mapper.
+   */
+  size_t kernels_mapped = 0;
+
+  /**
+   * Number of kernels for which a cached mapping result was used.
+   */
+  size_t kernels_cached = 0;
+
+  /**
+   * Number of kernels for which a mapping result from the replay trace was
+   * used.
+   */
+  size_t kernels_replayed = 0;
+
+  /**
+   * Number of kernels that didn't need to be routed.
+   */
+  size_t kernels_fast_path = 0;
+
+  /**
+   * Number of times a kernel was mapped with an additional mapper
+   * configuration.
+   */
+  size_t trials_mapped = 0;
+
+  /**
+   * Number of kernels for which the result of an additional mapper
+   * configuration was better than that of the base configuration.
+   */
+  size_t trials_won = 0;
+
+  /**
+   * Number of kernels that were flushed because they filled up the window,
+   * rather than because of a measurement.
+   */
+  size_t window_flushes = 0;
+
+  /**
+   * Number of measurements that only flushed their causal cone, leaving
+   * other gates queued up, and the total number of gates left queued up by
+   * them.
+   */
+  size_t cone_flushes = 0;
+  size_t cone_gates_queued = 0;
+
+  /**
+   * Histogram of the number of gates in the flushed kernels. Bucket i counts
+   * the kernels with a size in [2^i, 2^(i+1)).
+   */
+  std::vector<size_t> kernel_sizes;
+
+  /**
+   * Time spent detecting incoming gates, in seconds.
+   */
+  double detect_time = 0.0;
+
+  /**
+   * Time spent in the peephole optimizer, in seconds.
+   */
+  double peephole_time = 0.0;
+
+  /**
+   * Time spent computing or loading the routing tables, in seconds.
+   */
+  double routes_time = 0.0;
+
+  /**
+   * Time spent choosing the initial placement, in seconds.
+   */
+  double placement_time = 0.0;
+
+  /**
+   * Time spent in the OpenQL mapper, in seconds.
+   */
+  double map_time = 0.0;
+
+  /**
+   * Time spent constructing and sending gates downstream, in seconds.
+   */
+  double emit_time = 0.0;
+
+  /**
+   * Records the size of a flushed kernel in the histogram.
+   */
+  void record_kernel_size(size_t size) {
+    size_t bucket = 0;
+    while (size >> (bucket + 1)) {
+      bucket++;
+    }
+    if (kernel_sizes.size() <= bucket) {
+      kernel_sizes.resize(bucket + 1, 0);
+    }
+    kernel_sizes[bucket]++;
+  }
+
+  /**
+   * Returns the counters as a JSON object.
+   */
+  nlohmann::json to_json() const {
+    nlohmann::json histogram = nlohmann::json::object();
+    for (size_t bucket = 0; bucket < kernel_sizes.size(); bucket++) {
+      if (!kernel_sizes[bucket]) {
+        continue;
+      }
+      size_t low = (size_t)1 << bucket;
+      size_t high = (low << 1) - 1;
+      std::string key = std::to_string(low);
+      if (high != low) {
+        key += "-" + std::to_string(high);
+      }
+      histogram[key] = kernel_sizes[bucket];
+    }
+    return {
+      {"gates_in", gates_in},
+      {"gates_out", gates_out},
+      {"gates_coalesced", gates_coalesced},
+      {"swaps_inserted", swaps_inserted},
+      {"swaps_virtual", swaps_virtual},
+      {"measurements_deferred", measurements_deferred},
+      {"kernels", {
+        {"mapped", kernels_mapped},
+        {"cached", kernels_cached},
+        {"replayed", kernels_replayed},
+        {"fast_path", kernels_fast_path},
+        {"trials", trials_mapped},
+        {"trials_won", trials_won},
+        {"window_flushes", window_flushes},
+        {"cone_flushes", cone_flushes},
+        {"cone_gates_queued", cone_gates_queued},
+        {"size_histogram", histogram}
+      }},
+      {"time", {
+        {"detect", detect_time},
+        {"peephole", peephole_time},
+        {"routes", routes_time},
+        {"placement", placement_time},
+        {"map", map_time},
+        {"emit", emit_time}
+      }}
+    };
+  }
+
+};
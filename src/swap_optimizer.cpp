@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <swap_optimizer.hpp>
+
+// Alias the dqcsim::wrap namespace to something shorter.
+namespace dqcs = dqcsim::wrap;
+
+// Marker for a missing gate or index.
+static const size_t NONE = (size_t)-1;
+
+/**
+ * Prepares the optimizer for the given gatemap and number of downstream
+ * qubits, folding swaps into the cnot gate with the given ID, or not at all
+ * if it is -1. The gatemap must outlive the optimizer.
+ */
+SwapOptimizer::SwapOptimizer(
+  const OpenQLGateMap &gatemap,
+  size_t num_qubits,
+  size_t fold_id
+) : gatemap(gatemap), fold_id(fold_id), held(num_qubits), held_at(num_qubits, NONE),
+  held_run(num_qubits, 0)
+{
+}
+
+/**
+ * Returns the ID of the cnot gate that the given hardware configuration
+ * decomposes swaps into, or -1 if it doesn't decompose swaps into three
+ * cnots that the gatemap knows about.
+ */
+size_t SwapOptimizer::find_fold_gate(
+  const OpenQLGateMap &gatemap,
+  const nlohmann::json &hardware_config
+) {
+  auto decompositions = hardware_config.find("gate_decomposition");
+  if (decompositions == hardware_config.end() || !decompositions->is_object()) {
+    return NONE;
+  }
+  for (auto it = decompositions->begin(); it != decompositions->end(); it++) {
+
+    // Only look at generic decompositions of a swap gate, as in
+    // "swap %0,%1".
+    const std::string &key = it.key();
+    std::string name = key.substr(0, key.find(' '));
+    if (key.find('%') == std::string::npos || !it.value().is_array() || it.value().size() != 3) {
+      continue;
+    }
+    try {
+      if (!gatemap.is_swap(gatemap.get_id(name))) {
+        continue;
+      }
+
+      // The decomposition must consist of three of the same gate, which must
+      // be a cnot.
+      std::string cnot;
+      for (const auto &gate : it.value()) {
+        std::string gate_name = gate.get<std::string>();
+        gate_name = gate_name.substr(0, gate_name.find(' '));
+        if (cnot.empty()) {
+          cnot = gate_name;
+        } else if (gate_name != cnot) {
+          cnot.clear();
+          break;
+        }
+      }
+      if (cnot.empty()) {
+        continue;
+      }
+      size_t id = gatemap.get_id(cnot);
+      const OpenQLGateSpec &spec = gatemap.get_specs()[id];
+      if (spec.kind == OpenQLGateSpec::Kind::Predefined
+        && spec.predefined == dqcs::PredefinedGate::X
+        && spec.controlled == 1
+        && !spec.has_angle
+      ) {
+        return id;
+      }
+    } catch (const std::exception &) {
+      continue;
+    }
+  }
+  return NONE;
+}
+
+/**
+ * Appends a gate to the gates that are ready to be sent downstream.
+ */
+void SwapOptimizer::append(size_t id, const std::vector<size_t> &qubits, double angle) {
+  if (ready.size() <= num_ready) {
+    ready.resize(num_ready + 1);
+  }
+  OpenQLGateDescription &desc = ready[num_ready++];
+  desc.id = id;
+  desc.qubits.assign(qubits.begin(), qubits.end());
+  desc.angle = angle;
+  desc.multi_qubit_parallel = false;
+}
+
+/**
+ * Appends a two-qubit gate without an angle to the gates that are ready to be
+ * sent downstream.
+ */
+void SwapOptimizer::append(size_t id, size_t a, size_t b) {
+  if (ready.size() <= num_ready) {
+    ready.resize(num_ready + 1);
+  }
+  OpenQLGateDescription &desc = ready[num_ready++];
+  desc.id = id;
+  desc.qubits.clear();
+  desc.qubits.push_back(a);
+  desc.qubits.push_back(b);
+  desc.angle = 0.0;
+  desc.multi_qubit_parallel = false;
+}
+
+/**
+ * Holds back the given two-qubit gate.
+ */
+void SwapOptimizer::hold(size_t id, const std::vector<size_t> &qubits) {
+  size_t index = std::min(qubits[0], qubits[1]);
+  OpenQLGateDescription &desc = held[index];
+  desc.id = id;
+  desc.qubits.assign(qubits.begin(), qubits.end());
+  desc.angle = 0.0;
+  desc.multi_qubit_parallel = false;
+  held_at[qubits[0]] = index;
+  held_at[qubits[1]] = index;
+  held_run[index] = 1;
+}
+
+/**
+ * Stops holding back the gate or run of cnots at the given index, sending it
+ * downstream if send is set.
+ */
+void SwapOptimizer::release(size_t index, bool send) {
+  const OpenQLGateDescription &desc = held[index];
+  for (size_t qubit : desc.qubits) {
+    held_at[qubit] = NONE;
+  }
+  if (send) {
+    for (size_t i = 0; i < held_run[index]; i++) {
+      if (i % 2 == 0) {
+        append(desc.id, desc.qubits[0], desc.qubits[1]);
+      } else {
+        append(desc.id, desc.qubits[1], desc.qubits[0]);
+      }
+    }
+  }
+}
+
+/**
+ * Processes a gate that is to be sent downstream. Afterwards, the gates that
+ * are ready to be sent downstream are available through get_ready().
+ */
+void SwapOptimizer::push(size_t id, const std::vector<size_t> &qubits, double angle) {
+  num_ready = 0;
+  bool swap = qubits.size() == 2 && gatemap.is_swap(id);
+  bool cnot = qubits.size() == 2 && id == fold_id;
+
+  // Combine the gate with the gate held back on the same pair, if any.
+  if (swap || cnot) {
+    size_t index = held_at[qubits[0]];
+    if (index != NONE && held_at[qubits[1]] == index) {
+      OpenQLGateDescription &before = held[index];
+      bool before_swap = gatemap.is_swap(before.id);
+      if (before_swap && swap) {
+        release(index, false);
+        swaps_cancelled++;
+        return;
+      }
+
+      // The direction of the last cnot of the run, if a cnot is held.
+      size_t control = before.qubits[held_run[index] % 2 ? 0 : 1];
+      size_t target = before.qubits[held_run[index] % 2 ? 1 : 0];
+
+      if (!before_swap && cnot) {
+        if (qubits[0] == control) {
+
+          // The cnot cancels out with the last cnot of the run.
+          if (--held_run[index] == 0) {
+            release(index, false);
+          }
+          cnots_cancelled++;
+          return;
+        }
+        if (++held_run[index] == 4) {
+
+          // cnot(x, y) cnot(y, x) cnot(x, y) = swap(x, y)
+          // = cnot(y, x) cnot(x, y) cnot(y, x), so the fourth cnot cancels
+          // out with the run in reverse.
+          std::swap(before.qubits[0], before.qubits[1]);
+          held_run[index] = 2;
+          swaps_folded++;
+          cnots_cancelled++;
+        }
+        return;
+      }
+      if (before_swap && cnot) {
+
+        // swap(x, y) cnot(x, y) = cnot(x, y) cnot(y, x).
+        release(index, false);
+        append(fold_id, qubits[0], qubits[1]);
+        append(fold_id, qubits[1], qubits[0]);
+        swaps_folded++;
+        return;
+      }
+      if (swap) {
+
+        // cnot(x, y) swap(x, y) = cnot(y, x) cnot(x, y), applied to the last
+        // cnot of the run.
+        held_run[index]--;
+        release(index, true);
+        append(fold_id, target, control);
+        append(fold_id, control, target);
+        swaps_folded++;
+        return;
+      }
+    }
+  }
+
+  // Send any gates held back on the qubits of this gate first.
+  for (size_t qubit : qubits) {
+    if (held_at[qubit] != NONE) {
+      release(held_at[qubit], true);
+    }
+  }
+
+  if (swap || cnot) {
+    hold(id, qubits);
+  } else {
+    append(id, qubits, angle);
+  }
+}
+
+/**
+ * Stops holding back any gates. Afterwards, they are available through
+ * get_ready().
+ */
+void SwapOptimizer::flush() {
+  num_ready = 0;
+  for (size_t qubit = 0; qubit < held_at.size(); qubit++) {
+    if (held_at[qubit] == qubit) {
+      release(qubit, true);
+    }
+  }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <vector>
+#include <json.h>
+#include "gates.hpp"
+
+/**
+ * Post-routing optimizer for the stream of gates sent downstream.
+ *
+ * The mapper regularly inserts a swap that is undone right away by the next
+ * swap on the same pair, either within a kernel or by the routing of the
+ * next kernel. To catch those, swaps are held back before being sent
+ * downstream, until the next gate on either of their qubits arrives:
+ *
+ *  - a swap on the same pair cancels the held swap;
+ *  - if swaps can be folded (see below), a cnot on the same pair is folded
+ *    into the held swap;
+ *  - anything else sends the held swap first.
+ *
+ * Held swaps are only sent on demand otherwise, so cancellation works across
+ * kernel boundaries. flush() must be called before anything can observe the
+ * downstream state, other than through measurements, which send any held
+ * gates on their qubits anyway.
+ *
+ * When the platform decomposes swaps into three cnots, a swap next to a cnot
+ * on the same pair is better expressed as two cnots, as the middle cnots of
+ * the decomposition cancel out with each other and with the original cnot.
+ * In that case, cnots are held back as well, and a cnot followed by the
+ * same cnot cancels out. The mapper then sends swaps downstream in their
+ * decomposed form, so the optimizer holds back runs of up to three cnots on
+ * a pair, alternating in direction. Three alternating cnots are a swap in
+ * either direction, so a fourth reverses the run and cancels out with its
+ * last cnot, folding the swap into the cnot.
+ *
+ * All qubit indices are downstream qubit indices, counting from zero.
+ */
+class SwapOptimizer {
+private:
+
+  /**
+   * The gatemap, used to recognize swap gates.
+   */
+  const OpenQLGateMap &gatemap;
+
+  /**
+   * ID of the cnot gate swaps are folded into, or -1 if swaps can't be
+   * folded.
+   */
+  size_t fold_id;
+
+  /**
+   * Held gates, indexed by the lower of their two qubits, and for each
+   * qubit, the index of the held gate acting on it or -1 if there is none.
+   * For cnots, the held gate is the first of a run of held_run cnots that
+   * alternate in direction.
+   */
+  std::vector<OpenQLGateDescription> held;
+  std::vector<size_t> held_at;
+  std::vector<size_t> held_run;
+
+  /**
+   * Gates ready to be sent downstream, and their number. Entries beyond the
+   * number are stale, but kept around to reuse their capacity.
+   */
+  std::vector<OpenQLGateDescription> ready;
+  size_t num_ready = 0;
+
+  /**
+   * Appends a gate to the gates that are ready to be sent downstream.
+   */
+  void append(size_t id, const std::vector<size_t> &qubits, double angle);
+
+  /**
+   * Appends a two-qubit gate without an angle to the gates that are ready to
+   * be sent downstream.
+   */
+  void append(size_t id, size_t a, size_t b);
+
+  /**
+   * Holds back the given two-qubit gate.
+   */
+  void hold(size_t id, const std::vector<size_t> &qubits);
+
+  /**
+   * Stops holding back the gate or run of cnots at the given index, sending
+   * it downstream if send is set.
+   */
+  void release(size_t index, bool send);
+
+public:
+
+  /**
+   * Number of pairs of swaps that cancelled out.
+   */
+  size_t swaps_cancelled = 0;
+
+  /**
+   * Number of swaps folded into a cnot, either as a swap gate or in
+   * decomposed form.
+   */
+  size_t swaps_folded = 0;
+
+  /**
+   * Number of pairs of cnots that cancelled out.
+   */
+  size_t cnots_cancelled = 0;
+
+  /**
+   * Prepares the optimizer for the given gatemap and number of downstream
+   * qubits, folding swaps into the cnot gate with the given ID, or not at
+   * all if it is -1. The gatemap must outlive the optimizer.
+   */
+  SwapOptimizer(const OpenQLGateMap &gatemap, size_t num_qubits, size_t fold_id);
+
+  /**
+   * Returns the ID of the cnot gate that the given hardware configuration
+   * decomposes swaps into, or -1 if it doesn't decompose swaps into three
+   * cnots that the gatemap knows about.
+   */
+  static size_t find_fold_gate(const OpenQLGateMap &gatemap, const nlohmann::json &hardware_config);
+
+  /**
+   * Returns whether swaps are folded into cnots.
+   */
+  bool is_folding() const {
+    return fold_id != (size_t)-1;
+  }
+
+  /**
+   * Processes a gate that is to be sent downstream. Afterwards, the gates
+   * that are ready to be sent downstream are available through get_ready().
+   */
+  void push(size_t id, const std::vector<size_t> &qubits, double angle);
+
+  /**
+   * Stops holding back any gates. Afterwards, they are available through
+   * get_ready().
+   */
+  void flush();
+
+  /**
+   * Returns the number of gates ready to be sent downstream.
+   */
+  size_t get_num_ready() const {
+    return num_ready;
+  }
+
+  /**
+   * Returns the given gate that is ready to be sent downstream.
+   */
+  const OpenQLGateDescription &get_ready(size_t index) const {
+    return ready[index];
+  }
+
+};
@@ -0,0 +1,142 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <timeline.hpp>
+
+std::atomic<bool> Timeline::recording(false);
+const size_t Timeline::CAPACITY;
+
+/**
+ * An event recorded on the timeline, with its time in nanoseconds since
+ * recording was enabled.
+ */
+class TimelineEvent {
+public:
+  const char *name;
+  uint64_t time;
+  char phase;
+};
+
+/**
+ * Ring buffer of the events recorded by a single thread.
+ */
+class TimelineBuffer {
+public:
+
+  // Thread ID used in the output, counting from one in order of the first
+  // event recorded by each thread.
+  size_t tid;
+
+  // The events, the index of the next event to record, and whether older
+  // events have been overwritten.
+  std::vector<TimelineEvent> events;
+  size_t next = 0;
+  bool wrapped = false;
+
+};
+
+/**
+ * Returns the lock protecting the list of buffers.
+ */
+static std::mutex &buffers_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+/**
+ * Returns the buffers of all threads that recorded events.
+ */
+static std::vector<std::unique_ptr<TimelineBuffer>> &buffers() {
+  static std::vector<std::unique_ptr<TimelineBuffer>> buffers;
+  return buffers;
+}
+
+// The time at which recording was enabled.
+static std::chrono::steady_clock::time_point epoch;
+
+// The buffer of the calling thread, or null if it hasn't recorded any events
+// yet. Buffers are owned by buffers(), so they outlive their thread.
+static thread_local TimelineBuffer *local_buffer = nullptr;
+
+/**
+ * Starts recording events.
+ */
+void Timeline::enable() {
+  if (!enabled()) {
+    epoch = std::chrono::steady_clock::now();
+    recording.store(true);
+  }
+}
+
+/**
+ * Records an event with the given name and Chrome trace event phase.
+ */
+void Timeline::record(const char *name, char phase) {
+  uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - epoch).count();
+  TimelineBuffer *buffer = local_buffer;
+  if (buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(buffers_mutex());
+    buffers().emplace_back(new TimelineBuffer());
+    buffer = buffers().back().get();
+    buffer->tid = buffers().size();
+    buffer->events.resize(CAPACITY);
+    local_buffer = buffer;
+  }
+  TimelineEvent &event = buffer->events[buffer->next];
+  event.name = name;
+  event.time = time;
+  event.phase = phase;
+  if (++buffer->next == CAPACITY) {
+    buffer->next = 0;
+    buffer->wrapped = true;
+  }
+}
+
+/**
+ * Writes the events recorded so far to the given file as Chrome trace event
+ * JSON. Must not be called while other threads are recording. Returns false
+ * if the file couldn't be written.
+ */
+bool Timeline::write(const std::string &fname) {
+  std::lock_guard<std::mutex> lock(buffers_mutex());
+  std::ofstream ofs(fname);
+  ofs << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  long pid = getpid();
+  char line[256];
+  for (const auto &buffer : buffers()) {
+
+    // Walk the ring buffer from the oldest event. If it wrapped around, the
+    // begin events of the oldest end events may have been overwritten, so
+    // skip end events that don't have a begin event to keep them balanced.
+    size_t start = buffer->wrapped ? buffer->next : 0;
+    size_t count = buffer->wrapped ? CAPACITY : buffer->next;
+    size_t depth = 0;
+    for (size_t index = 0; index < count; index++) {
+      const TimelineEvent &event = buffer->events[(start + index) % CAPACITY];
+      if (event.phase == 'E') {
+        if (!depth) {
+          continue;
+        }
+        depth--;
+      } else {
+        depth++;
+      }
+      std::snprintf(
+        line, sizeof(line),
+        "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%ld,\"tid\":%zu}",
+        first ? "" : ",", event.name, event.phase,
+        (unsigned long long)(event.time / 1000), (unsigned)(event.time % 1000),
+        pid, buffer->tid);
+      ofs << line;
+      first = false;
+    }
+  }
+  ofs << "\n]}" << std::endl;
+  return (bool)ofs;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Process-wide recorder for a timeline of begin and end events, written out
+ * in the Chrome trace event format, which chrome://tracing and Perfetto can
+ * display.
+ *
+ * Recording is disabled until enable() is called, in which case recording an
+ * event costs a single relaxed atomic load. Once enabled, each thread records
+ * into its own ring buffer, allocated on its first event, so recording
+ * doesn't need any locking. Only the most recent events of each thread are
+ * kept when a buffer fills up.
+ *
+ * Event names are not copied, so they must be string literals.
+ */
+class Timeline {
+private:
+
+  /**
+   * Whether events are being recorded.
+   */
+  static std::atomic<bool> recording;
+
+  /**
+   * Records an event with the given name and Chrome trace event phase.
+   */
+  static void record(const char *name, char phase);
+
+public:
+
+  /**
+   * Number of events kept for each thread.
+   */
+  static const size_t CAPACITY = 1 << 18;
+
+  /**
+   * Starts recording events.
+   */
+  static void enable();
+
+  /**
+   * Returns whether events are being recorded.
+   */
+  static bool enabled() {
+    return recording.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Records the start of the given event on the calling thread.
+   */
+  static void begin(const char *name) {
+    if (enabled()) {
+      record(name, 'B');
+    }
+  }
+
+  /**
+   * Records the end of the given event on the calling thread.
+   */
+  static void end(const char *name) {
+    if (enabled()) {
+      record(name, 'E');
+    }
+  }
+
+  /**
+   * Writes the events recorded so far to the given file as Chrome trace
+   * event JSON. Must not be called while other threads are recording.
+   * Returns false if the file couldn't be written.
+   */
+  static bool write(const std::string &fname);
+
+};
+
+/**
+ * Records an event on the timeline spanning a scope.
+ */
+class TimelineScope {
+private:
+  const char *name;
+
+public:
+
+  /**
+   * Records the start of the given event, and its end when the scope is
+   * left.
+   */
+  TimelineScope(const char *name) : name(Timeline::enabled() ? name : nullptr) {
+    if (this->name) {
+      Timeline::begin(name);
+    }
+  }
+
+  ~TimelineScope() {
+    if (name) {
+      Timeline::end(name);
+    }
+  }
+
+};
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <topology.hpp>
+
+// Magic number and version at the start of each route cache file.
+static const char ROUTES_MAGIC[8] = {'D', 'Q', 'C', 'S', 'O', 'M', 'R', 'T'};
+static const uint32_t ROUTES_VERSION = 2;
+
+/**
+ * Constructs the topology for a platform with the given number of qubits
+ * from the given "topology" JSON object.
+ */
+Topology::Topology(const nlohmann::json &topology, size_t num_qubits)
+  : num_qubits(num_qubits), row_words((num_qubits + 63) / 64)
+{
+  adjacency.assign(num_qubits * row_words, 0);
+
+  // Handle full connectivity.
+  auto it = topology.find("connectivity");
+  if (it != topology.end() && it->is_string() && it->get<std::string>() == "full") {
+    for (size_t a = 0; a < num_qubits; a++) {
+      for (size_t b = 0; b < num_qubits; b++) {
+        if (a != b) {
+          adjacency[a * row_words + b / 64] |= (uint64_t)1 << (b % 64);
+        }
+      }
+    }
+  } else {
+
+    // Handle the edge list.
+    add_edges(topology);
+
+  }
+
+  // Hash the qubit count and adjacency matrix (64-bit FNV-1a).
+  hash = 0xcbf29ce484222325ull;
+  auto hash_word = [this](uint64_t word) {
+    for (size_t byte = 0; byte < 8; byte++) {
+      hash ^= (word >> (byte * 8)) & 0xFF;
+      hash *= 0x100000001b3ull;
+    }
+  };
+  hash_word(num_qubits);
+  for (uint64_t word : adjacency) {
+    hash_word(word);
+  }
+}
+
+/**
+ * Adds the edges from the "edges" list of the given "topology" JSON object
+ * to the adjacency matrix.
+ */
+void Topology::add_edges(const nlohmann::json &topology) {
+  auto it = topology.find("edges");
+  if (it == topology.end()) {
+    return;
+  }
+  for (const auto &edge : *it) {
+    size_t src = edge.at("src");
+    size_t dst = edge.at("dst");
+    if (src >= num_qubits || dst >= num_qubits) {
+      throw std::runtime_error(
+        "topology edge " + std::to_string(src) + " -> " + std::to_string(dst)
+        + " refers to a nonexistent qubit");
+    }
+    adjacency[src * row_words + dst / 64] |= (uint64_t)1 << (dst % 64);
+    adjacency[dst * row_words + src / 64] |= (uint64_t)1 << (src % 64);
+  }
+}
+
+/**
+ * Creates the given directory and its parents if they don't exist yet.
+ * Returns whether the directory exists afterwards.
+ */
+static bool make_dirs(const std::string &path) {
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+    std::string prefix = path.substr(0, pos);
+    if (mkdir(prefix.c_str(), 0777) != 0 && errno != EEXIST) {
+      return false;
+    }
+    if (pos == std::string::npos) {
+      return true;
+    }
+  }
+}
+
+/**
+ * Computes the all-pairs distance table. If cache_dir is nonempty, the table
+ * is loaded from a file in that directory keyed by the hash of the topology
+ * if it exists, and saved there otherwise.
+ */
+void Topology::compute_routes(const std::string &cache_dir) {
+  if (num_qubits >= 0xFFFF) {
+    throw std::runtime_error(
+      "platforms with " + std::to_string(num_qubits) + " qubits are not supported");
+  }
+
+  std::string fname;
+  if (!cache_dir.empty()) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+    fname = cache_dir + "/routes-" + buf + ".bin";
+    if (load_routes(fname)) {
+      return;
+    }
+  }
+
+  // Build adjacency lists, then do a breadth-first search from each qubit,
+  // filling in the column of the table for that qubit.
+  std::vector<std::vector<uint16_t>> neighbors(num_qubits);
+  for (size_t a = 0; a < num_qubits; a++) {
+    for (size_t b = 0; b < num_qubits; b++) {
+      if (adjacent(a, b)) {
+        neighbors[a].push_back(b);
+      }
+    }
+  }
+  size_t cells = num_qubits * num_qubits;
+  std::shared_ptr<std::vector<uint16_t>> table(
+    new std::vector<uint16_t>(cells, num_qubits));
+  uint16_t *dist_table = table->data();
+  std::vector<uint16_t> queue;
+  queue.reserve(num_qubits);
+  for (size_t root = 0; root < num_qubits; root++) {
+    dist_table[root * num_qubits + root] = 0;
+    queue.clear();
+    queue.push_back(root);
+    for (size_t head = 0; head < queue.size(); head++) {
+      size_t cur = queue[head];
+      uint16_t dist = dist_table[cur * num_qubits + root] + 1;
+      for (uint16_t next : neighbors[cur]) {
+        if (dist_table[next * num_qubits + root] == num_qubits) {
+          dist_table[next * num_qubits + root] = dist;
+          queue.push_back(next);
+        }
+      }
+    }
+  }
+  use_routes(table, dist_table);
+
+  if (!fname.empty()) {
+    save_routes(fname);
+  }
+}
+
+/**
+ * Uses the given distance table, owned by the given object, instead of
+ * computing it. The table must have been computed for this topology.
+ */
+void Topology::use_routes(
+  const std::shared_ptr<const void> &owner,
+  const uint16_t *distances
+) {
+  routes_owner = owner;
+  this->distances = distances;
+}
+
+/**
+ * Tries to load the distance table from the given cache file. Returns
+ * false if the file doesn't exist or doesn't match this topology.
+ */
+bool Topology::load_routes(const std::string &fname) {
+  std::ifstream ifs(fname, std::ios::binary);
+  if (!ifs) {
+    return false;
+  }
+  char magic[sizeof(ROUTES_MAGIC)];
+  uint32_t version;
+  uint32_t file_qubits;
+  uint64_t file_hash;
+  ifs.read(magic, sizeof(magic));
+  ifs.read(reinterpret_cast<char*>(&version), sizeof(version));
+  ifs.read(reinterpret_cast<char*>(&file_qubits), sizeof(file_qubits));
+  ifs.read(reinterpret_cast<char*>(&file_hash), sizeof(file_hash));
+  if (!ifs
+    || !std::equal(magic, magic + sizeof(magic), ROUTES_MAGIC)
+    || version != ROUTES_VERSION
+    || file_qubits != num_qubits
+    || file_hash != hash
+  ) {
+    return false;
+  }
+
+  // Compare the adjacency matrix as well, so a hash collision can't result
+  // in wrong routes.
+  std::vector<uint64_t> file_adjacency(adjacency.size());
+  ifs.read(reinterpret_cast<char*>(file_adjacency.data()), file_adjacency.size() * sizeof(uint64_t));
+  if (!ifs || file_adjacency != adjacency) {
+    return false;
+  }
+
+  std::shared_ptr<std::vector<uint16_t>> table(new std::vector<uint16_t>(num_qubits * num_qubits));
+  ifs.read(reinterpret_cast<char*>(table->data()), table->size() * sizeof(uint16_t));
+  if (!ifs) {
+    return false;
+  }
+  use_routes(table, table->data());
+  return true;
+}
+
+/**
+ * Saves the distance table to the given cache file. Failure is not an
+ * error; the table is simply recomputed next time.
+ */
+void Topology::save_routes(const std::string &fname) const {
+  size_t slash = fname.rfind('/');
+  if (slash != std::string::npos && slash > 0 && !make_dirs(fname.substr(0, slash))) {
+    return;
+  }
+
+  // Write to a temporary file first and then rename it, so concurrent
+  // simulations never see a partially written file.
+  std::string tmp_fname = fname + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream ofs(tmp_fname, std::ios::binary);
+    uint32_t file_qubits = num_qubits;
+    ofs.write(ROUTES_MAGIC, sizeof(ROUTES_MAGIC));
+    ofs.write(reinterpret_cast<const char*>(&ROUTES_VERSION), sizeof(ROUTES_VERSION));
+    ofs.write(reinterpret_cast<const char*>(&file_qubits), sizeof(file_qubits));
+    ofs.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+    ofs.write(reinterpret_cast<const char*>(adjacency.data()), adjacency.size() * sizeof(uint64_t));
+    ofs.write(reinterpret_cast<const char*>(distances), num_qubits * num_qubits * sizeof(uint16_t));
+    if (!ofs) {
+      ofs.close();
+      std::remove(tmp_fname.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+    std::remove(tmp_fname.c_str());
+  }
+}
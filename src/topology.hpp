@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <json.h>
+
+/**
+ * Connectivity of the qubits of a platform, derived from the "topology"
+ * section of an OpenQL hardware configuration file.
+ */
+class Topology {
+private:
+
+  /**
+   * Number of qubits in the platform.
+   */
+  size_t num_qubits = 0;
+
+  /**
+   * Number of 64-bit words per row of the adjacency matrix.
+   */
+  size_t row_words = 0;
+
+  /**
+   * Adjacency matrix stored as a bitset, row-major.
+   */
+  std::vector<uint64_t> adjacency;
+
+  /**
+   * Hash of the topology, identifying it in the route cache.
+   */
+  uint64_t hash = 0;
+
+  /**
+   * Owner of the memory that the distance table lives in; either a vector
+   * allocated by compute_routes(), or a memory-mapped snapshot. Copies of
+   * the topology share the table.
+   */
+  std::shared_ptr<const void> routes_owner;
+
+  /**
+   * All-pairs distance matrix, row-major, in number of edges. Unreachable
+   * pairs are set to num_qubits. Null until the routes are computed.
+   */
+  const uint16_t *distances = nullptr;
+
+  /**
+   * Adds the edges from the "edges" list of the given "topology" JSON object
+   * to the adjacency matrix.
+   */
+  void add_edges(const nlohmann::json &topology);
+
+  /**
+   * Tries to load the distance table from the given cache file. Returns
+   * false if the file doesn't exist or doesn't match this topology.
+   */
+  bool load_routes(const std::string &fname);
+
+  /**
+   * Saves the distance table to the given cache file. Failure is not an
+   * error; the table is simply recomputed next time.
+   */
+  void save_routes(const std::string &fname) const;
+
+public:
+
+  Topology() = default;
+
+  /**
+   * Constructs the topology for a platform with the given number of qubits
+   * from the given "topology" JSON object. Like OpenQL, we assume that all
+   * qubits are connected if "connectivity" is set to "full"; otherwise the
+   * connections are taken from the "edges" list. Edges are interpreted as
+   * bidirectional.
+   */
+  Topology(const nlohmann::json &topology, size_t num_qubits);
+
+  /**
+   * Returns the number of qubits in the platform.
+   */
+  size_t size() const {
+    return num_qubits;
+  }
+
+  /**
+   * Computes the all-pairs distance table. If cache_dir is nonempty, the
+   * table is loaded from a file in that directory keyed by the hash of the
+   * topology if it exists, and saved there otherwise.
+   *
+   * \throws std::runtime_error when the platform has too many qubits for
+   * the table.
+   */
+  void compute_routes(const std::string &cache_dir);
+
+  /**
+   * Uses the given distance table, owned by the given object, instead of
+   * computing it. The table must have been computed for this topology.
+   */
+  void use_routes(
+    const std::shared_ptr<const void> &owner,
+    const uint16_t *distances);
+
+  /**
+   * Returns the hash of the topology.
+   */
+  uint64_t get_hash() const {
+    return hash;
+  }
+
+  /**
+   * Returns the adjacency matrix, as a row-major bitset with rows padded to
+   * 64-bit words.
+   */
+  const std::vector<uint64_t> &get_adjacency() const {
+    return adjacency;
+  }
+
+  /**
+   * Returns the distance table, as a row-major matrix, or null if the
+   * routes haven't been computed.
+   */
+  const uint16_t *get_distances() const {
+    return distances;
+  }
+
+  /**
+   * Returns the number of edges on a shortest path between the given
+   * physical qubits, or size() if there is no path. compute_routes() must
+   * have been called.
+   */
+  size_t distance(size_t a, size_t b) const {
+    return distances[a * num_qubits + b];
+  }
+
+  /**
+   * Returns whether a two-qubit gate can be applied to the given physical
+   * qubits directly.
+   */
+  bool adjacent(size_t a, size_t b) const {
+    if (a >= num_qubits || b >= num_qubits) {
+      return false;
+    }
+    return (adjacency[a * row_words + b / 64] >> (b % 64)) & 1;
+  }
+
+};
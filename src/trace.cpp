@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <trace.hpp>
+
+// Magic number and version at the start of each trace file.
+static const char TRACE_MAGIC[8] = {'D', 'Q', 'C', 'S', 'O', 'M', 'T', 'R'};
+static const uint32_t TRACE_VERSION = 2;
+
+// Encoding of unmapped qubits in a trace.
+static const uint32_t TRACE_UNMAPPED = 0xFFFFFFFF;
+
+/**
+ * Hashes a kernel cache key for use in a trace (64-bit FNV-1a).
+ */
+uint64_t trace_hash(const std::string &key) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : key) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/**
+ * Writes a plain value to a stream.
+ */
+template <typename T>
+static void put(std::ofstream &ofs, const T &value) {
+  ofs.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/**
+ * Reads a plain value from a stream. Returns false if the stream ended.
+ */
+template <typename T>
+static bool get(std::ifstream &ifs, T &value) {
+  ifs.read(reinterpret_cast<char*>(&value), sizeof(value));
+  return (bool)ifs;
+}
+
+/**
+ * Writes a qubit placement to a stream.
+ */
+static void put_placement(std::ofstream &ofs, const std::vector<size_t> &v2r) {
+  put(ofs, (uint32_t)v2r.size());
+  for (size_t phys : v2r) {
+    put(ofs, phys == (size_t)-1 ? TRACE_UNMAPPED : (uint32_t)phys);
+  }
+}
+
+/**
+ * Opens the given trace file for writing, and writes the header for the
+ * given gatemap.
+ *
+ * \throws std::runtime_error when the file could not be opened.
+ */
+TraceWriter::TraceWriter(const std::string &fname, const OpenQLGateMap &gatemap)
+  : ofs(fname, std::ios::binary), fname(fname)
+{
+  if (!ofs) {
+    throw std::runtime_error("Failed to open trace file " + fname + " for writing");
+  }
+  ofs.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  put(ofs, TRACE_VERSION);
+  put(ofs, (uint32_t)gatemap.size());
+  for (size_t id = 0; id < gatemap.size(); id++) {
+    const std::string &name = gatemap.get_name(id);
+    put(ofs, (uint32_t)name.size());
+    ofs.write(name.data(), name.size());
+  }
+  if (!ofs) {
+    throw std::runtime_error("Failed to write trace file " + fname);
+  }
+}
+
+/**
+ * Writes a record for a kernel with the given key hash.
+ *
+ * \throws std::runtime_error when writing fails.
+ */
+void TraceWriter::write(uint64_t hash, const KernelCache::Entry &entry) {
+  put(ofs, hash);
+  put(ofs, (uint32_t)entry.gates.size());
+  for (const OpenQLGateDescription &gate : entry.gates) {
+    put(ofs, (uint32_t)gate.id);
+    put(ofs, (uint8_t)gate.qubits.size());
+    for (size_t qubit : gate.qubits) {
+      put(ofs, (uint32_t)qubit);
+    }
+    put(ofs, gate.angle);
+  }
+  put_placement(ofs, entry.v2r_in);
+  put_placement(ofs, entry.v2r_out);
+
+  // Flush after each record, so the trace is usable even if the simulation
+  // is aborted.
+  ofs.flush();
+  if (!ofs) {
+    throw std::runtime_error("Failed to write trace file " + fname);
+  }
+}
+
+/**
+ * Opens the given trace file for reading, and checks its header against
+ * the given gatemap. Qubit indices in the records are checked against the
+ * given number of physical qubits.
+ *
+ * \throws std::runtime_error when the file could not be opened, is not a
+ * trace file, or was recorded with a different gatemap.
+ */
+TraceReader::TraceReader(const std::string &fname, const OpenQLGateMap &gatemap, size_t num_qubits)
+  : ifs(fname, std::ios::binary), fname(fname), num_gate_ids(gatemap.size()), num_qubits(num_qubits)
+{
+  if (!ifs) {
+    throw std::runtime_error("Failed to open trace file " + fname + " for reading");
+  }
+  char magic[sizeof(TRACE_MAGIC)];
+  uint32_t version;
+  ifs.read(magic, sizeof(magic));
+  if (!ifs || !std::equal(magic, magic + sizeof(magic), TRACE_MAGIC)) {
+    throw std::runtime_error(fname + " is not a mapper trace file");
+  }
+  if (!get(ifs, version) || version != TRACE_VERSION) {
+    throw std::runtime_error(fname + " has an unsupported trace file version");
+  }
+  uint32_t num_gates;
+  if (!get(ifs, num_gates) || num_gates != gatemap.size()) {
+    throw std::runtime_error(fname + " was recorded with a different gatemap");
+  }
+  std::string name;
+  for (size_t id = 0; id < num_gates; id++) {
+    uint32_t len;
+    if (!get(ifs, len)) {
+      throw std::runtime_error(fname + " is truncated");
+    }
+    name.resize(len);
+    ifs.read(&name[0], len);
+    if (!ifs) {
+      throw std::runtime_error(fname + " is truncated");
+    }
+    if (name != gatemap.get_name(id)) {
+      throw std::runtime_error(fname + " was recorded with a different gatemap");
+    }
+  }
+}
+
+/**
+ * Reads a qubit placement, and checks that it maps to distinct physical
+ * qubits that exist.
+ *
+ * \throws std::runtime_error when the placement is truncated or corrupt.
+ */
+void TraceReader::read_placement(std::vector<size_t> &v2r) {
+  uint32_t count;
+  if (!get(ifs, count)) {
+    throw std::runtime_error(fname + " is truncated");
+  }
+  if (count > num_qubits) {
+    throw std::runtime_error(fname + " is corrupt");
+  }
+  std::vector<bool> used(num_qubits, false);
+  v2r.resize(count);
+  for (size_t &phys : v2r) {
+    uint32_t index;
+    if (!get(ifs, index)) {
+      throw std::runtime_error(fname + " is truncated");
+    }
+    if (index == TRACE_UNMAPPED) {
+      phys = (size_t)-1;
+      continue;
+    }
+    if (index >= num_qubits || used[index]) {
+      throw std::runtime_error(fname + " is corrupt");
+    }
+    used[index] = true;
+    phys = index;
+  }
+}
+
+/**
+ * Reads the next record. Returns false when the end of the trace has been
+ * reached.
+ *
+ * \throws std::runtime_error when the record is truncated or corrupt.
+ */
+bool TraceReader::next(uint64_t &hash, KernelCache::Entry &entry) {
+  if (!get(ifs, hash)) {
+    return false;
+  }
+  uint32_t num_gates;
+  if (!get(ifs, num_gates)) {
+    throw std::runtime_error(fname + " is truncated");
+  }
+  entry.gates.resize(num_gates);
+  for (OpenQLGateDescription &gate : entry.gates) {
+    uint32_t id;
+    uint8_t num_operands;
+    if (!get(ifs, id) || !get(ifs, num_operands)) {
+      throw std::runtime_error(fname + " is truncated");
+    }
+    if (id >= num_gate_ids) {
+      throw std::runtime_error(fname + " is corrupt");
+    }
+    gate.id = id;
+    gate.multi_qubit_parallel = false;
+    gate.qubits.resize(num_operands);
+    for (size_t &qubit : gate.qubits) {
+      uint32_t index;
+      if (!get(ifs, index)) {
+        throw std::runtime_error(fname + " is truncated");
+      }
+      if (index >= num_qubits) {
+        throw std::runtime_error(fname + " is corrupt");
+      }
+      qubit = index;
+    }
+    if (!get(ifs, gate.angle)) {
+      throw std::runtime_error(fname + " is truncated");
+    }
+  }
+  read_placement(entry.v2r_in);
+  read_placement(entry.v2r_out);
+  return true;
+}
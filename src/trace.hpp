@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include "gates.hpp"
+#include "kernel_cache.hpp"
+
+/**
+ * Record/replay traces of mapping results.
+ *
+ * A trace is a binary file containing, for each kernel that was mapped (or
+ * taken from the kernel cache) in order, a hash of the kernel cache key, the
+ * mapped gates, the initial placement if one was chosen, and the resulting
+ * placement. When replaying, the records are
+ * streamed back in order, and used instead of invoking the mapper as long as
+ * the hash of the current kernel matches the next record. Since the mapper is
+ * seeded from DQCsim's random number generator, this reproduces the original
+ * run exactly, as long as the gatemap and inputs are the same.
+ *
+ * The file starts with a magic number, a version, and the list of gate names
+ * in gate ID order, such that a trace isn't accidentally replayed with a
+ * different gatemap. All integers are stored in native byte order, so traces
+ * are not portable between architectures.
+ */
+
+/**
+ * Hashes a kernel cache key for use in a trace (64-bit FNV-1a).
+ */
+uint64_t trace_hash(const std::string &key);
+
+/**
+ * Writes a trace file.
+ */
+class TraceWriter {
+private:
+
+  /**
+   * The output stream.
+   */
+  std::ofstream ofs;
+
+  /**
+   * Name of the trace file, for error messages.
+   */
+  std::string fname;
+
+public:
+
+  /**
+   * Opens the given trace file for writing, and writes the header for the
+   * given gatemap.
+   *
+   * \throws std::runtime_error when the file could not be opened.
+   */
+  TraceWriter(const std::string &fname, const OpenQLGateMap &gatemap);
+
+  /**
+   * Writes a record for a kernel with the given key hash.
+   *
+   * \throws std::runtime_error when writing fails.
+   */
+  void write(uint64_t hash, const KernelCache::Entry &entry);
+
+};
+
+/**
+ * Reads a trace file.
+ */
+class TraceReader {
+private:
+
+  /**
+   * The input stream.
+   */
+  std::ifstream ifs;
+
+  /**
+   * Name of the trace file, for error messages.
+   */
+  std::string fname;
+
+  /**
+   * Number of gates in the gatemap, for validating gate IDs.
+   */
+  size_t num_gate_ids;
+
+  /**
+   * Number of physical qubits, for validating qubit indices.
+   */
+  size_t num_qubits;
+
+  /**
+   * Reads a qubit placement, and checks that it maps to distinct physical
+   * qubits that exist.
+   *
+   * \throws std::runtime_error when the placement is truncated or corrupt.
+   */
+  void read_placement(std::vector<size_t> &v2r);
+
+public:
+
+  /**
+   * Opens the given trace file for reading, and checks its header against
+   * the given gatemap. Qubit indices in the records are checked against the
+   * given number of physical qubits.
+   *
+   * \throws std::runtime_error when the file could not be opened, is not a
+   * trace file, or was recorded with a different gatemap.
+   */
+  TraceReader(const std::string &fname, const OpenQLGateMap &gatemap, size_t num_qubits);
+
+  /**
+   * Reads the next record. Returns false when the end of the trace has been
+   * reached.
+   *
+   * \throws std::runtime_error when the record is truncated or corrupt.
+   */
+  bool next(uint64_t &hash, KernelCache::Entry &entry);
+
+};
@@ -0,0 +1,462 @@
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <unitary_index.hpp>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Alias the dqcsim::wrap namespace to something shorter.
+namespace dqcs = dqcsim::wrap;
+
+// Marker for a missing gate ID.
+static const size_t NO_GATE = (size_t)-1;
+
+// Maximum number of matrix elements of a fixed entry that may be close to the
+// fingerprint threshold. The entry is added to the bucket of every possible
+// fingerprint, so this bounds the number of buckets per entry to 16.
+static const size_t MAX_AMBIGUOUS = 4;
+
+/**
+ * Returns whether |a[i] - phase * b[i]| <= epsilon for the given number of
+ * complex elements of a and b.
+ */
+static bool approx_equal(
+  const dqcs::complex *a,
+  const dqcs::complex *b,
+  size_t size,
+  dqcs::complex phase,
+  double epsilon
+) {
+  double limit = epsilon * epsilon;
+  size_t i = 0;
+
+  // std::complex<double> is guaranteed to be laid out as an array of its
+  // real and imaginary part.
+#if defined(__AVX__) || defined(__SSE2__)
+  const double *pa = reinterpret_cast<const double*>(a);
+  const double *pb = reinterpret_cast<const double*>(b);
+#endif
+
+#if defined(__AVX__)
+  // Two complex numbers per register. phase * b is computed as
+  // (pr*br - pi*bi, pr*bi + pi*br) using addsub on b and b with its real and
+  // imaginary parts swapped.
+  __m256d vpr = _mm256_set1_pd(phase.real());
+  __m256d vpi = _mm256_set1_pd(phase.imag());
+  __m256d vlimit = _mm256_set1_pd(limit);
+  for (; i + 2 <= size; i += 2) {
+    __m256d va = _mm256_loadu_pd(pa + 2 * i);
+    __m256d vb = _mm256_loadu_pd(pb + 2 * i);
+    __m256d swapped = _mm256_permute_pd(vb, 0x5);
+    __m256d prod = _mm256_addsub_pd(_mm256_mul_pd(vpr, vb), _mm256_mul_pd(vpi, swapped));
+    __m256d diff = _mm256_sub_pd(va, prod);
+    __m256d sq = _mm256_mul_pd(diff, diff);
+    __m256d norm = _mm256_hadd_pd(sq, sq);
+    if (_mm256_movemask_pd(_mm256_cmp_pd(norm, vlimit, _CMP_NLE_UQ))) {
+      return false;
+    }
+  }
+#elif defined(__SSE2__)
+  // One complex number per register. Without SSE3, the sign of the
+  // imaginary part of the phase is flipped for the real part instead of
+  // using addsub.
+  __m128d vpr = _mm_set1_pd(phase.real());
+  __m128d vpi = _mm_set_pd(phase.imag(), -phase.imag());
+  __m128d vlimit = _mm_set_sd(limit);
+  for (; i < size; i++) {
+    __m128d va = _mm_loadu_pd(pa + 2 * i);
+    __m128d vb = _mm_loadu_pd(pb + 2 * i);
+    __m128d swapped = _mm_shuffle_pd(vb, vb, 1);
+    __m128d prod = _mm_add_pd(_mm_mul_pd(vpr, vb), _mm_mul_pd(vpi, swapped));
+    __m128d diff = _mm_sub_pd(va, prod);
+    __m128d sq = _mm_mul_pd(diff, diff);
+    __m128d norm = _mm_add_sd(sq, _mm_unpackhi_pd(sq, sq));
+    if (!_mm_comile_sd(norm, vlimit)) {
+      return false;
+    }
+  }
+#endif
+
+  for (; i < size; i++) {
+    if (!(std::norm(a[i] - phase * b[i]) <= limit)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Compares matrix a against matrix b, of which the element at the given
+ * index has the largest magnitude. Global phase is ignored for uncontrolled
+ * gates, and reported as uncertain for controlled gates.
+ */
+static UnitaryIndex::Result compare_matrices(
+  const dqcs::complex *a,
+  const dqcs::complex *b,
+  size_t size,
+  size_t pivot,
+  bool controlled,
+  double epsilon
+) {
+  if (controlled && approx_equal(a, b, size, 1.0, epsilon)) {
+    return UnitaryIndex::Result::Found;
+  }
+
+  // Find the global phase difference from the largest element of b.
+  if (std::abs(a[pivot]) < epsilon) {
+    return UnitaryIndex::Result::NotFound;
+  }
+  dqcs::complex phase = a[pivot] / b[pivot];
+  phase /= std::abs(phase);
+  if (!approx_equal(a, b, size, phase, epsilon)) {
+    return UnitaryIndex::Result::NotFound;
+  }
+  return controlled ? UnitaryIndex::Result::Uncertain : UnitaryIndex::Result::Found;
+}
+
+/**
+ * Returns the number of qubits of a square matrix with the given number of
+ * elements, or zero if there is no such matrix.
+ */
+static size_t matrix_qubits(size_t size) {
+  size_t qubits = 0;
+  while (size > 1 && !(size & 3)) {
+    size >>= 2;
+    qubits++;
+  }
+  return size == 1 ? qubits : 0;
+}
+
+/**
+ * Returns the bucket key for the given shape and fingerprint.
+ */
+uint64_t UnitaryIndex::bucket_key(uint64_t shape, const std::vector<uint64_t> &fingerprint) {
+  uint64_t hash = 14695981039346656037ull;
+  hash = (hash ^ shape) * 1099511628211ull;
+  for (uint64_t word : fingerprint) {
+    hash = (hash ^ word) * 1099511628211ull;
+  }
+  return hash;
+}
+
+/**
+ * Computes the fingerprint of the given matrix, being a bitmask of the
+ * elements with a magnitude above a threshold. This is invariant to global
+ * phase. Returns in ambiguous the indices of the elements that are too close
+ * to the threshold to tell, if not null.
+ */
+void UnitaryIndex::fingerprint(
+  const dqcs::complex *matrix,
+  size_t size,
+  std::vector<uint64_t> &fingerprint,
+  std::vector<size_t> *ambiguous
+) const {
+
+  // The threshold must be well above the accuracy, so the zero elements of a
+  // matrix are never ambiguous.
+  double threshold = std::max(1.0e-3, 4.0 * epsilon);
+  fingerprint.assign((size + 63) / 64, 0);
+  if (ambiguous) {
+    ambiguous->clear();
+  }
+  for (size_t i = 0; i < size; i++) {
+    double magnitude = std::abs(matrix[i]);
+    if (magnitude > threshold) {
+      fingerprint[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+    if (ambiguous && std::abs(magnitude - threshold) <= 2.0 * epsilon) {
+      ambiguous->push_back(i);
+    }
+  }
+}
+
+/**
+ * Compares the given gate matrix against the given fixed entry.
+ */
+UnitaryIndex::Result UnitaryIndex::compare(
+  const dqcs::complex *matrix,
+  size_t size,
+  const Entry &entry,
+  bool controlled
+) const {
+  return compare_matrices(matrix, &pool[entry.offset], size, entry.pivot, controlled, epsilon);
+}
+
+/**
+ * Determines the angle of the given gate matrix for the given rotation entry,
+ * and compares the matrix against the rotation by that angle.
+ */
+UnitaryIndex::Result UnitaryIndex::compare_rotation(
+  const dqcs::complex *matrix,
+  const Entry &entry,
+  bool controlled,
+  double &angle
+) const {
+  const dqcs::complex i(0.0, 1.0);
+
+  // Any rotation by theta is e^(i phi) (cos(theta/2) I - i sin(theta/2) P)
+  // for the Pauli matrix P of its axis. Extract x = e^(i phi) cos(theta/2)
+  // and y = e^(i phi) sin(theta/2) from the matrix.
+  dqcs::complex x, y;
+  switch (entry.axis) {
+    case Axis::X:
+      x = matrix[0];
+      y = i * matrix[2];
+      break;
+    case Axis::Y:
+      x = matrix[0];
+      y = matrix[2];
+      break;
+    case Axis::Z:
+    default:
+      x = 0.5 * (matrix[0] + matrix[3]);
+      y = -0.5 * i * (matrix[3] - matrix[0]);
+      break;
+  }
+
+  // For controlled rotations, global phase matters, so the angle is taken
+  // as-is. Otherwise, remove the global phase using the larger of the two,
+  // and normalize the angle, as rotations by theta and theta + 2 pi only
+  // differ in global phase.
+  if (controlled) {
+    angle = 2.0 * std::atan2(y.real(), x.real());
+  } else {
+    dqcs::complex phase = std::abs(x) >= std::abs(y) ? x : y;
+    if (std::abs(phase) < epsilon) {
+      return Result::NotFound;
+    }
+    phase = std::conj(phase) / std::abs(phase);
+    angle = std::remainder(2.0 * std::atan2((y * phase).real(), (x * phase).real()), 2.0 * M_PI);
+  }
+
+  // Build the rotation matrix for the angle and compare.
+  dqcs::complex rotation[4];
+  double c = std::cos(0.5 * angle);
+  double s = std::sin(0.5 * angle);
+  switch (entry.axis) {
+    case Axis::X:
+      rotation[0] = c;
+      rotation[1] = -i * s;
+      rotation[2] = -i * s;
+      rotation[3] = c;
+      break;
+    case Axis::Y:
+      rotation[0] = c;
+      rotation[1] = -s;
+      rotation[2] = s;
+      rotation[3] = c;
+      break;
+    case Axis::Z:
+    default:
+      rotation[0] = dqcs::complex(c, -s);
+      rotation[1] = 0.0;
+      rotation[2] = 0.0;
+      rotation[3] = dqcs::complex(c, s);
+      break;
+  }
+  size_t pivot = 0;
+  for (size_t index = 1; index < 4; index++) {
+    if (std::abs(rotation[index]) > std::abs(rotation[pivot])) {
+      pivot = index;
+    }
+  }
+  return compare_matrices(matrix, rotation, 4, pivot, controlled, epsilon);
+}
+
+/**
+ * Adds an entry with the given ID, number of control qubits, and matrix for
+ * its target qubits.
+ */
+void UnitaryIndex::add_matrix(
+  size_t id,
+  size_t controls,
+  const std::vector<dqcs::complex> &matrix
+) {
+  size_t targets = matrix_qubits(matrix.size());
+  if (!targets) {
+    add_unindexed(id, controls, targets);
+    return;
+  }
+  Entry entry;
+  entry.id = id;
+  entry.controls = controls;
+  entry.targets = targets;
+  entry.offset = pool.size();
+  entry.pivot = 0;
+  for (size_t index = 1; index < matrix.size(); index++) {
+    if (std::abs(matrix[index]) > std::abs(matrix[entry.pivot])) {
+      entry.pivot = index;
+    }
+  }
+  entry.rotation = false;
+  entry.axis = Axis::X;
+  pool.insert(pool.end(), matrix.begin(), matrix.end());
+  size_t index = entries.size();
+  entries.push_back(entry);
+
+  // Add the entry to the bucket for every fingerprint the matrix of a
+  // matching gate could have.
+  uint64_t shape = shape_key(controls, targets);
+  Shape &sh = shapes[shape];
+  sh.controls = controls;
+  std::vector<uint64_t> fp;
+  std::vector<size_t> ambiguous;
+  fingerprint(matrix.data(), matrix.size(), fp, &ambiguous);
+  if (ambiguous.size() > MAX_AMBIGUOUS) {
+    sh.unbucketed.push_back(index);
+    return;
+  }
+  for (size_t combination = 0; combination < ((size_t)1 << ambiguous.size()); combination++) {
+    for (size_t bit = 0; bit < ambiguous.size(); bit++) {
+      uint64_t mask = (uint64_t)1 << (ambiguous[bit] % 64);
+      if (combination & ((size_t)1 << bit)) {
+        fp[ambiguous[bit] / 64] |= mask;
+      } else {
+        fp[ambiguous[bit] / 64] &= ~mask;
+      }
+    }
+    buckets[bucket_key(shape, fp)].push_back(index);
+  }
+}
+
+/**
+ * Adds a parameterized single-qubit rotation entry with the given ID, number
+ * of control qubits, and axis.
+ */
+void UnitaryIndex::add_rotation(size_t id, size_t controls, Axis axis) {
+  Entry entry;
+  entry.id = id;
+  entry.controls = controls;
+  entry.targets = 1;
+  entry.offset = 0;
+  entry.pivot = 0;
+  entry.rotation = true;
+  entry.axis = axis;
+  Shape &sh = shapes[shape_key(controls, 1)];
+  sh.controls = controls;
+  sh.rotations.push_back(entries.size());
+  entries.push_back(entry);
+}
+
+/**
+ * Adds an entry with the given ID and number of control and target qubits
+ * that can't be indexed.
+ */
+void UnitaryIndex::add_unindexed(size_t id, size_t controls, size_t targets) {
+  Entry entry;
+  entry.id = id;
+  entry.controls = controls;
+  entry.targets = targets;
+  entry.offset = 0;
+  entry.pivot = 0;
+  entry.rotation = false;
+  entry.axis = Axis::X;
+  unindexed.push_back(entry);
+}
+
+/**
+ * Builds the index after all entries were added, in ascending ID order. This
+ * determines the guards for each shape: the entries with the same total
+ * number of qubits but a different number of controls, and the entries that
+ * couldn't be indexed.
+ */
+void UnitaryIndex::build() {
+  guard.clear();
+  for (auto &it : shapes) {
+    Shape &sh = it.second;
+    size_t total = sh.controls + (it.first & 0xFFFFFFFF);
+    sh.guards.clear();
+    for (const Entry &entry : entries) {
+      if (entry.controls != sh.controls && entry.controls + entry.targets == total) {
+        sh.guards.push_back(entry.id);
+      }
+    }
+    for (const Entry &entry : unindexed) {
+      if (entry.controls + entry.targets == total) {
+        sh.guards.push_back(entry.id);
+      }
+    }
+    std::sort(sh.guards.begin(), sh.guards.end());
+    for (size_t id : sh.guards) {
+      if (guard.size() <= id) {
+        guard.resize(id + 1);
+      }
+      guard[id] = true;
+    }
+  }
+}
+
+/**
+ * Looks up a unitary gate with the given number of control qubits and the
+ * given matrix for its target qubits. If it is found, id is set to the
+ * matching entry with the lowest ID, and angle to its angle if it is a
+ * rotation. The guards that must be tried first are returned in guards, or
+ * null if the index doesn't know the shape of the gate at all.
+ */
+UnitaryIndex::Result UnitaryIndex::find(
+  size_t controls,
+  const std::vector<dqcs::complex> &matrix,
+  size_t &id,
+  double &angle,
+  const std::vector<size_t> *&guards
+) {
+  guards = nullptr;
+  size_t targets = matrix_qubits(matrix.size());
+  if (!targets) {
+    return Result::NotFound;
+  }
+  uint64_t shape = shape_key(controls, targets);
+  auto sh = shapes.find(shape);
+  if (sh == shapes.end()) {
+    return Result::NotFound;
+  }
+  guards = &sh->second.guards;
+  bool controlled = controls > 0;
+  Result result = Result::NotFound;
+  id = NO_GATE;
+
+  // Each candidate list is in ascending ID order, so only the first match in
+  // each list can be the lowest.
+  fingerprint(matrix.data(), matrix.size(), scratch_fingerprint, nullptr);
+  auto bucket = buckets.find(bucket_key(shape, scratch_fingerprint));
+  const std::vector<size_t> *lists[] = {
+    bucket != buckets.end() ? &bucket->second : nullptr,
+    &sh->second.unbucketed
+  };
+  for (const std::vector<size_t> *list : lists) {
+    if (!list) {
+      continue;
+    }
+    for (size_t index : *list) {
+      const Entry &entry = entries[index];
+      if (entry.id >= id) {
+        break;
+      }
+      Result r = compare(matrix.data(), matrix.size(), entry, controlled);
+      if (r != Result::NotFound) {
+        id = entry.id;
+        result = r;
+        break;
+      }
+    }
+  }
+  for (size_t index : sh->second.rotations) {
+    const Entry &entry = entries[index];
+    if (entry.id >= id) {
+      break;
+    }
+    double rotation_angle;
+    Result r = compare_rotation(matrix.data(), entry, controlled, rotation_angle);
+    if (r != Result::NotFound) {
+      id = entry.id;
+      angle = rotation_angle;
+      result = r;
+      break;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <dqcsim>
+
+/**
+ * Index over the unitary entries of a gatemap, used to detect unitary gates
+ * without going through the DQCsim gatemap, which tries every entry in turn.
+ *
+ * Entries are grouped by their shape, being their number of control and
+ * target qubits. Within a shape, entries with a fixed matrix are bucketed by
+ * a phase-invariant fingerprint of the matrix, being the pattern of its
+ * nonzero entries, so only the entries in a single bucket need to be
+ * compared with the matrix of a gate. RX, RY and RZ entries can't be
+ * fingerprinted, because their matrix depends on the angle; instead, the
+ * angle is computed from the matrix of the gate, after which the matrix is
+ * compared with that of the rotation by that angle.
+ *
+ * Matrices are compared like the DQCsim gatemap does, entry by entry within
+ * the gatemap accuracy. Global phase is ignored for gates without control
+ * qubits. For controlled gates, the DQCsim gatemap may ignore it as well, so
+ * a match that depends on global phase is reported as uncertain.
+ *
+ * Some entries can't be indexed, either because they have a different shape
+ * than the gates they may match (the DQCsim gatemap can move qubits between
+ * the controls and the matrix of a gate), or because their matrix isn't
+ * known in advance. These are guards: they must be tried using DQCsim before
+ * any indexed entry with a higher ID, to get the same result as the DQCsim
+ * gatemap, which returns the first entry that matches.
+ */
+class UnitaryIndex {
+public:
+
+  /**
+   * Rotation axis of a parameterized entry.
+   */
+  enum class Axis : uint8_t {
+    X,
+    Y,
+    Z
+  };
+
+  /**
+   * Result of a lookup.
+   */
+  enum class Result : uint8_t {
+
+    // An indexed entry matches.
+    Found,
+
+    // No indexed entry matches.
+    NotFound,
+
+    // An indexed entry matches, but only if the DQCsim gatemap ignores
+    // global phase for controlled gates.
+    Uncertain
+
+  };
+
+private:
+
+  /**
+   * An entry of the index.
+   */
+  class Entry {
+  public:
+
+    // Gate ID of the entry.
+    size_t id;
+
+    // Number of control and target qubits of the entry.
+    size_t controls;
+    size_t targets;
+
+    // Offset of the matrix of a fixed entry in the matrix pool, and the
+    // index of its largest element, from which global phase is determined.
+    size_t offset;
+    size_t pivot;
+
+    // Whether the entry is a rotation, and its axis if so.
+    bool rotation;
+    Axis axis;
+
+  };
+
+  /**
+   * The entries with a particular number of control and target qubits.
+   */
+  class Shape {
+  public:
+
+    // Number of control qubits.
+    size_t controls = 0;
+
+    // Indices of the fixed entries that couldn't be bucketed, because too
+    // many elements of their matrix are close to the fingerprint threshold.
+    std::vector<size_t> unbucketed;
+
+    // Indices of the rotation entries.
+    std::vector<size_t> rotations;
+
+    // IDs of the guards for this shape, in ascending order.
+    std::vector<size_t> guards;
+
+  };
+
+  /**
+   * The indexed entries, in the order in which they were added.
+   */
+  std::vector<Entry> entries;
+
+  /**
+   * The matrices of the fixed entries, concatenated.
+   */
+  std::vector<dqcsim::wrap::complex> pool;
+
+  /**
+   * The entries that aren't indexed. Only their ID and shape are used.
+   */
+  std::vector<Entry> unindexed;
+
+  /**
+   * The shapes, keyed by shape_key().
+   */
+  std::unordered_map<uint64_t, Shape> shapes;
+
+  /**
+   * The fingerprint buckets, keyed by a hash of the shape and fingerprint,
+   * containing indices into entries in ascending ID order.
+   */
+  std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+
+  /**
+   * Whether each gate ID is a guard for some shape.
+   */
+  std::vector<bool> guard;
+
+  /**
+   * Matrix comparison accuracy.
+   */
+  double epsilon;
+
+  /**
+   * Scratch space for the fingerprint of the gate being looked up, kept
+   * around to reuse its capacity.
+   */
+  std::vector<uint64_t> scratch_fingerprint;
+
+  /**
+   * Returns the key for the given number of control and target qubits.
+   */
+  static uint64_t shape_key(size_t controls, size_t targets) {
+    return ((uint64_t)controls << 32) | targets;
+  }
+
+  /**
+   * Returns the bucket key for the given shape and fingerprint.
+   */
+  static uint64_t bucket_key(uint64_t shape, const std::vector<uint64_t> &fingerprint);
+
+  /**
+   * Computes the fingerprint of the given matrix. Returns in ambiguous the
+   * indices of the elements that are too close to the threshold to tell,
+   * if not null.
+   */
+  void fingerprint(
+    const dqcsim::wrap::complex *matrix,
+    size_t size,
+    std::vector<uint64_t> &fingerprint,
+    std::vector<size_t> *ambiguous) const;
+
+  /**
+   * Compares the given gate matrix against the given fixed entry.
+   */
+  Result compare(const dqcsim::wrap::complex *matrix, size_t size, const Entry &entry, bool controlled) const;
+
+  /**
+   * Determines the angle of the given gate matrix for the given rotation
+   * entry, and compares the matrix against the rotation by that angle.
+   */
+  Result compare_rotation(const dqcsim::wrap::complex *matrix, const Entry &entry, bool controlled, double &angle) const;
+
+public:
+
+  /**
+   * Constructs an empty index with the given matrix comparison accuracy.
+   */
+  UnitaryIndex(double epsilon = 1.0e-6) : epsilon(epsilon) {
+  }
+
+  /**
+   * Adds an entry with the given ID, number of control qubits, and matrix
+   * for its target qubits.
+   */
+  void add_matrix(size_t id, size_t controls, const std::vector<dqcsim::wrap::complex> &matrix);
+
+  /**
+   * Adds a parameterized single-qubit rotation entry with the given ID,
+   * number of control qubits, and axis.
+   */
+  void add_rotation(size_t id, size_t controls, Axis axis);
+
+  /**
+   * Adds an entry with the given ID and number of control and target qubits
+   * that can't be indexed.
+   */
+  void add_unindexed(size_t id, size_t controls, size_t targets);
+
+  /**
+   * Builds the index after all entries were added, in ascending ID order.
+   */
+  void build();
+
+  /**
+   * Returns whether the entry with the given ID is a guard for some shape.
+   */
+  bool is_guard(size_t id) const {
+    return id < guard.size() && guard[id];
+  }
+
+  /**
+   * Looks up a unitary gate with the given number of control qubits and the
+   * given matrix for its target qubits. If it is found, id is set to the
+   * matching entry with the lowest ID, and angle to its angle if it is a
+   * rotation. The guards that must be tried first are returned in guards,
+   * or null if the index doesn't know the shape of the gate at all.
+   */
+  Result find(
+    size_t controls,
+    const std::vector<dqcsim::wrap::complex> &matrix,
+    size_t &id,
+    double &angle,
+    const std::vector<size_t> *&guards);
+
+};